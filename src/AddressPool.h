@@ -0,0 +1,166 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <bitset>
+#include "Ip6Address.h"
+
+// Hands out interface ids 1..capacity inside one prefix. A bitmap records
+// which ids are taken; released ids go on a free list and are reused
+// before the high-water mark advances, so clients coming and going never
+// drain the pool. An id is on the free list at most once, however often
+// it is released; a second bitmap tracks which ids are listed. Memory is
+// two bits per id up to the highest one issued.
+// allocate() only draws from the window [firstId, lastId], so servers that
+// share a prefix can split it; reserve() and release() take any id.
+class AddressPool {
+  private:
+    Ip6Prefix prefix;
+    uint64_t capacity = 0;
+    uint64_t firstId = 1;
+    uint64_t lastId = 0;
+    uint64_t nextId = 1;          // lowest id in the window never handed out
+    uint64_t inUse = 0;
+    std::vector<uint64_t> bitmap; // bit (id - 1) set = id taken
+    std::vector<uint64_t> freeIds;
+    std::vector<uint64_t> listed; // bit (id - 1) set = id on freeIds
+
+    static bool testBit(const std::vector<uint64_t>& bits, uint64_t id) {
+        uint64_t i = id - 1;
+        return i / 64 < bits.size() && ((bits[i / 64] >> (i % 64)) & 1);
+    }
+    static void setBit(std::vector<uint64_t>& bits, uint64_t id) {
+        uint64_t i = id - 1;
+        if (i / 64 >= bits.size()) bits.resize(i / 64 + 1, 0);
+        bits[i / 64] |= 1ULL << (i % 64);
+    }
+    static void clearBit(std::vector<uint64_t>& bits, uint64_t id) {
+        uint64_t i = id - 1;
+        if (i / 64 < bits.size()) bits[i / 64] &= ~(1ULL << (i % 64));
+    }
+
+    bool test(uint64_t id) const { return testBit(bitmap, id); }
+    void set(uint64_t id) {
+        setBit(bitmap, id);
+        inUse++;
+    }
+    void clear(uint64_t id) {
+        clearBit(bitmap, id);
+        inUse--;
+    }
+
+  public:
+    void init(const Ip6Prefix& p, uint64_t maxIds) {
+        prefix = p;
+        int hostBits = std::min(128 - p.length, 63);
+        capacity = std::min(maxIds, (uint64_t)((1ULL << hostBits) - 1));
+        firstId = nextId = 1;
+        lastId = capacity;
+        inUse = 0;
+        bitmap.clear();
+        freeIds.clear();
+        listed.clear();
+    }
+
+    // Restricts allocation to ids first..last (clamped to the capacity)
+    void setWindow(uint64_t first, uint64_t last) {
+        firstId = std::max(first, (uint64_t)1);
+        lastId = std::min(last, capacity);
+        nextId = std::max(nextId, firstId);
+    }
+
+    bool inWindow(uint64_t id) const { return id >= firstId && id <= lastId; }
+
+    const Ip6Prefix& getPrefix() const { return prefix; }
+    uint64_t getCapacity() const { return capacity; }
+    uint64_t getInUse() const { return inUse; }
+    uint64_t getNextId() const { return nextId; }
+    uint64_t getWindowSize() const { return lastId >= firstId ? lastId - firstId + 1 : 0; }
+
+    bool contains(const Ip6Address& a) const { return prefix.contains(a); }
+
+    // Complete allocation state, for checkpoints. restore() expects a pool
+    // initialized with the same prefix, capacity and window.
+    const std::vector<uint64_t>& getBitmap() const { return bitmap; }
+    const std::vector<uint64_t>& getFreeIds() const { return freeIds; }
+    void restore(uint64_t next, const std::vector<uint64_t>& bits, const std::vector<uint64_t>& free) {
+        nextId = next;
+        bitmap = bits;
+        freeIds.clear();
+        listed.clear();
+        for (uint64_t id : free)
+            if (!testBit(listed, id)) {
+                setBit(listed, id);
+                freeIds.push_back(id);
+            }
+        inUse = 0;
+        for (uint64_t word : bitmap)
+            inUse += std::bitset<64>(word).count();
+    }
+
+    // 0 if the address is outside the range this pool issues
+    uint64_t idOf(const Ip6Address& a) const {
+        if (!prefix.contains(a) || a.hi != prefix.net.hi) return 0;
+        uint64_t id = a.lo & ~prefix.maskLo();
+        return id <= capacity ? id : 0;
+    }
+
+    Ip6Address addressOf(uint64_t id) const {
+        return Ip6Address(prefix.net.hi, prefix.net.lo | id);
+    }
+
+    bool isAllocated(const Ip6Address& a) const {
+        uint64_t id = idOf(a);
+        return id && test(id);
+    }
+
+    bool allocate(Ip6Address& out) {
+        while (!freeIds.empty()) {
+            uint64_t id = freeIds.back();
+            freeIds.pop_back();
+            clearBit(listed, id);
+            if (!test(id)) {
+                set(id);
+                out = addressOf(id);
+                return true;
+            }
+        }
+        while (nextId <= lastId) {
+            uint64_t id = nextId++;
+            if (!test(id)) {
+                set(id);
+                out = addressOf(id);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Marks a specific address as taken, e.g. one learned from the partner.
+    // False if it is outside the pool or already taken, which the caller
+    // has to resolve: the id may be on offer to another client.
+    [[nodiscard]] bool reserve(const Ip6Address& a) {
+        uint64_t id = idOf(a);
+        if (!id || test(id)) return false;
+        set(id);
+        return true;
+    }
+
+    bool release(const Ip6Address& a) {
+        uint64_t id = idOf(a);
+        if (!id || !test(id)) return false;
+        clear(id);
+        if (inWindow(id) && !testBit(listed, id)) {
+            // still listed if it was reserved again since its last release
+            setBit(listed, id);
+            freeIds.push_back(id);
+        }
+        return true;
+    }
+
+    // Partner's high-water mark: ids below it may be out there unbound.
+    // Ignored when the partner allocates from a different window.
+    void advanceTo(uint64_t id) {
+        if (id > nextId && id <= lastId + 1) nextId = id;
+    }
+};
@@ -0,0 +1,130 @@
+#include "ArrivalProcess.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include "helpers.h"
+
+using namespace omnetpp;
+
+namespace {
+
+// The parsed traces of the current run. They are dropped when the network
+// is deleted, so the next run in the same process reads the file again.
+class TraceCache : public cISimulationLifecycleListener {
+  public:
+    std::map<std::string, std::shared_ptr<const std::vector<ArrivalProcess::TraceRow>>> loaded;
+
+    void listen() {
+        if (!listening) {
+            getEnvir()->addLifecycleListener(this);
+            listening = true;
+        }
+    }
+
+  protected:
+    virtual void lifecycleEvent(SimulationLifecycleEventType type, cObject *details) override {
+        if (type == LF_PRE_NETWORK_DELETE) loaded.clear();
+    }
+    virtual void listenerRemoved() override { listening = false; }
+
+  private:
+    bool listening = false;
+};
+
+TraceCache traceCache;
+
+}  // namespace
+
+void ArrivalProcess::init(cComponent *owner) {
+    this->owner = owner;
+    std::string name = owner->par("arrivalProcess").stdstringValue();
+    kind = name == "" ? NONE : name == "poisson" ? POISSON : name == "diurnal" ? DIURNAL :
+           name == "bootstorm" ? BOOTSTORM : name == "trace" ? TRACE : (Kind)-1;
+    if (kind == (Kind)-1)
+        throw cRuntimeError("arrivalProcess must be \"\", \"poisson\", \"diurnal\", \"bootstorm\" or \"trace\", got \"%s\"",
+                            name.c_str());
+    if (kind == NONE) return;
+
+    start = owner->par("arrivalStart").doubleValue();
+    if (kind == POISSON || kind == DIURNAL) {
+        double rate = owner->par("arrivalRate").doubleValue();
+        long count = owner->par("arrivalCount").intValue();
+        if (rate <= 0 || count <= 0)
+            throw cRuntimeError("arrivalRate and arrivalCount must be positive");
+        window = count / rate;
+    }
+    if (kind == DIURNAL) {
+        amplitude = owner->par("diurnalAmplitude").doubleValue();
+        period = owner->par("diurnalPeriod").doubleValue();
+        peak = owner->par("diurnalPeak").doubleValue();
+        if (amplitude < 0 || amplitude > 1 || period <= 0)
+            throw cRuntimeError("diurnalAmplitude must be in [0,1] and diurnalPeriod positive");
+    }
+    if (kind == TRACE) {
+        std::string path = owner->par("arrivalTrace").stdstringValue();
+        trace = loadTrace(path);
+        if (trace->empty())
+            throw cRuntimeError("Arrival trace '%s' is missing or has no rows", path.c_str());
+    }
+}
+
+const char *ArrivalProcess::getName() const {
+    switch (kind) {
+        case POISSON:   return "poisson";
+        case DIURNAL:   return "diurnal";
+        case BOOTSTORM: return "bootstorm";
+        case TRACE:     return "trace";
+        default:        return "";
+    }
+}
+
+simtime_t ArrivalProcess::startTime(int index) {
+    switch (kind) {
+        case POISSON:
+            return start + owner->uniform(0, window);
+        case DIURNAL: {
+            // Thinning: a uniform candidate survives with the relative rate
+            for (;;) {
+                double t = start + owner->uniform(0, window);
+                double rate = 1 + amplitude * std::cos(2 * M_PI * (t - peak) / period);
+                if (owner->uniform(0, 1 + amplitude) < rate)
+                    return t;
+            }
+        }
+        case BOOTSTORM:
+            return start + owner->par("bootDelay").doubleValue();
+        case TRACE:
+            return index >= 0 && index < (int)trace->size() ? start + (*trace)[index].at : -1;
+        default:
+            return -1;
+    }
+}
+
+std::shared_ptr<const std::vector<ArrivalProcess::TraceRow>> ArrivalProcess::loadTrace(const std::string& path) {
+    traceCache.listen();
+    auto it = traceCache.loaded.find(path);
+    if (it != traceCache.loaded.end())
+        return it->second;
+
+    // One "<seconds>,<type>" per line; a header, blank lines and # comments
+    // are skipped, and an empty type keeps the client's own
+    auto rows = std::make_shared<std::vector<TraceRow>>();
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        char *end;
+        double at = strtod(line.c_str(), &end);
+        if (end == line.c_str()) continue;   // header
+        size_t comma = line.find(',');
+        std::string type = comma == std::string::npos ? "" : line.substr(comma + 1);
+        size_t first = type.find_first_not_of(" \t");
+        size_t last = type.find_last_not_of(" \t");
+        type = first == std::string::npos ? "" : type.substr(first, last - first + 1);
+        rows->push_back({at, type.empty() ? -1 : deviceClassFromName(type.c_str())});
+    }
+    traceCache.loaded[path] = rows;
+    return rows;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <omnetpp.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// When the clients of a population first come up. Every client draws its
+// own start time independently of the others, so one process can span
+// many Device modules and ClientPopulations, in any partition, without a
+// shared generator. n independent draws from a density proportional to
+// the arrival rate are a Poisson process of that rate conditioned on n
+// arrivals, which is how "poisson" and "diurnal" are sampled:
+//
+//   poisson    rate arrivalRate from arrivalStart until all arrivalCount
+//              clients are up
+//   diurnal    the same mean rate, modulated by
+//              1 + diurnalAmplitude * cos(2 pi (t - diurnalPeak) / diurnalPeriod)
+//   bootstorm  power returns at arrivalStart and every client comes up
+//              bootDelay later, drawn per client
+//   trace      row arrivalIndex of the CSV file arrivalTrace, "<time>,<type>"
+//              per client; clients past the last row stay off
+//
+// The parameters live on the owning module, see Device in DeviceTypeDhcp.ned.
+class ArrivalProcess {
+  public:
+    struct TraceRow {
+        double at;
+        int devClass;   // -1 = keep the client's own type
+    };
+
+    // Reads arrivalProcess and its parameters; "" leaves the process unset
+    void init(omnetpp::cComponent *owner);
+    bool isSet() const { return kind != NONE; }
+    const char *getName() const;
+
+    // Start time of client index of the population, -1 if it never starts
+    omnetpp::simtime_t startTime(int index);
+
+    // Device class of client index from the trace, -1 if it has none
+    int traceClass(int index) const {
+        return kind == TRACE && index >= 0 && index < (int)trace->size() ? (*trace)[index].devClass : -1;
+    }
+
+  private:
+    enum Kind { NONE, POISSON, DIURNAL, BOOTSTORM, TRACE };
+    Kind kind = NONE;
+    omnetpp::cComponent *owner = nullptr;
+    double start = 0;
+    double window = 0;      // poisson, diurnal: time the arrivals span
+    double amplitude = 0;
+    double period = 1;
+    double peak = 0;
+    std::shared_ptr<const std::vector<TraceRow>> trace;
+
+    // Parsed once per file and run, shared by all clients replaying it
+    static std::shared_ptr<const std::vector<TraceRow>> loadTrace(const std::string& path);
+};
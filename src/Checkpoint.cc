@@ -0,0 +1,319 @@
+#include "Checkpoint.h"
+#include <cstdio>
+#include <algorithm>
+
+using namespace omnetpp;
+
+Register_PerRunConfigOptionU(CFGID_DHCP_CHECKPOINT_AT, "dhcp-checkpoint-at", "s", nullptr,
+        "Simulation time at which the state of the DHCP, Device and Switch modules "
+        "is written to dhcp-checkpoint-file; unset for no checkpoint.");
+Register_PerRunConfigOption(CFGID_DHCP_CHECKPOINT_FILE, "dhcp-checkpoint-file", CFG_FILENAME,
+        "${resultdir}/${configname}-#${repetition}.ckpt",
+        "File the checkpoint taken at dhcp-checkpoint-at is written to.");
+Register_PerRunConfigOption(CFGID_DHCP_RESUME_FROM, "dhcp-resume-from", CFG_FILENAME, "",
+        "Checkpoint file to start the run from, instead of an empty network. Times "
+        "of the resumed run count from the checkpoint.");
+
+// File header: magic, format version, simtime scale exponent
+static const uint64_t CHECKPOINT_MAGIC = 0x54504b4344484344ULL;  // "DCHDCKPT"
+static const uint64_t CHECKPOINT_VERSION = 3;
+
+// Fields of cMessage itself: name and kind are saved on their own, the
+// rest is routing the kernel fills in again
+static int messageFieldCount() {
+    static int count = -1;
+    if (count < 0) {
+        cClassDescriptor *desc = cClassDescriptor::getDescriptorFor(opp_typename(typeid(cMessage)));
+        if (!desc)
+            throw cRuntimeError("No class descriptor for cMessage");
+        count = desc->getFieldCount();
+    }
+    return count;
+}
+
+// Absolute times in messages carry @absoluteTime and move with the time line
+static bool isAbsoluteTime(cClassDescriptor *desc, int field) {
+    return desc->getFieldProperty(field, "absoluteTime") != nullptr;
+}
+
+void CheckpointWriter::putTimer(const cMessage *timer) {
+    bool scheduled = timer && timer->isScheduled();
+    putBool(scheduled);
+    if (scheduled)
+        putTime(timer->getArrivalTime());
+}
+
+void CheckpointWriter::putMessage(const cMessage *msg) {
+    putBool(msg != nullptr);
+    if (!msg) return;
+    putString(msg->getClassName());
+    putString(msg->getName());
+    putInt(msg->getKind());
+    putFields(toAnyPtr(static_cast<const cObject *>(msg)), cClassDescriptor::getDescriptorFor(msg),
+              messageFieldCount());
+}
+
+void CheckpointWriter::putFields(any_ptr obj, cClassDescriptor *desc, int firstField) {
+    for (int f = firstField; f < desc->getFieldCount(); f++) {
+        unsigned int flags = desc->getFieldTypeFlags(f);
+        int n = 1;
+        if (flags & cClassDescriptor::FD_ISARRAY) {
+            n = desc->getFieldArraySize(obj, f);
+            putInt(n);
+        }
+        for (int i = 0; i < n; i++) {
+            if (flags & cClassDescriptor::FD_ISPOINTER) {
+                if (!(flags & cClassDescriptor::FD_ISCOBJECT))
+                    throw cRuntimeError("Cannot checkpoint pointer field %s of %s", desc->getFieldName(f), desc->getName());
+                cObject *child = fromAnyPtr<cObject>(desc->getFieldStructValuePointer(obj, f, i));
+                putMessage(child ? check_and_cast<cMessage *>(child) : nullptr);
+            }
+            else if (flags & cClassDescriptor::FD_ISCOMPOUND) {
+                putFields(desc->getFieldStructValuePointer(obj, f, i),
+                          cClassDescriptor::getDescriptorFor(desc->getFieldStructName(f)), 0);
+            }
+            else if (isAbsoluteTime(desc, f)) {
+                putTime(SimTime::parse(desc->getFieldValueAsString(obj, f, i).c_str()));
+            }
+            else {
+                putString(desc->getFieldValueAsString(obj, f, i));
+            }
+        }
+    }
+}
+
+void CheckpointWriter::putInFlight(const cModule *module) {
+    // In the order they would arrive
+    cFutureEventSet *fes = getSimulation()->getFES();
+    std::vector<cMessage *> frames;
+    for (int i = 0; i < fes->getLength(); i++) {
+        cMessage *msg = dynamic_cast<cMessage *>(fes->get(i));
+        if (msg && !msg->isSelfMessage() && msg->getArrivalModuleId() == module->getId())
+            frames.push_back(msg);
+    }
+    std::sort(frames.begin(), frames.end(), [](const cMessage *a, const cMessage *b) {
+        if (a->getArrivalTime() != b->getArrivalTime()) return a->getArrivalTime() < b->getArrivalTime();
+        if (a->getSchedulingPriority() != b->getSchedulingPriority())
+            return a->getSchedulingPriority() < b->getSchedulingPriority();
+        return a->getInsertOrder() < b->getInsertOrder();
+    });
+
+    putUint(frames.size());
+    for (const cMessage *msg : frames) {
+        cGate *g = msg->getArrivalGate();
+        putString(g->getName());
+        putInt(g->isVector() ? g->getIndex() : -1);
+        putTime(msg->getArrivalTime());
+        putInt(msg->getSchedulingPriority());
+        putMessage(msg);
+    }
+}
+
+std::string CheckpointReader::getString() {
+    uint64_t n = getUint();
+    if (n > buf.size() - pos)
+        throw cRuntimeError("Checkpoint section of %s is truncated", where.c_str());
+    std::string s = buf.substr(pos, n);
+    pos += n;
+    return s;
+}
+
+void CheckpointReader::getTimer(cSimpleModule *module, cMessage *timer) {
+    bool scheduled = getBool();
+    simtime_t t = scheduled ? getTime() : SIMTIME_ZERO;
+    if (!timer) return;
+    if (scheduled)
+        module->rescheduleAt(t, timer);
+    else if (timer->isScheduled())
+        module->cancelEvent(timer);
+}
+
+cMessage *CheckpointReader::getMessage() {
+    if (!getBool()) return nullptr;
+    std::string className = getString();
+    cMessage *msg = check_and_cast<cMessage *>(createOne(className.c_str()));
+    msg->setName(getString().c_str());
+    msg->setKind(getInt());
+    getFields(toAnyPtr(static_cast<cObject *>(msg)), cClassDescriptor::getDescriptorFor(msg),
+              messageFieldCount());
+    return msg;
+}
+
+void CheckpointReader::getFields(any_ptr obj, cClassDescriptor *desc, int firstField) {
+    for (int f = firstField; f < desc->getFieldCount(); f++) {
+        unsigned int flags = desc->getFieldTypeFlags(f);
+        int n = 1;
+        if (flags & cClassDescriptor::FD_ISARRAY) {
+            n = getInt();
+            if (flags & cClassDescriptor::FD_ISRESIZABLE)
+                desc->setFieldArraySize(obj, f, n);
+            else if (n != desc->getFieldArraySize(obj, f))
+                throw cRuntimeError("Checkpoint of %s: field %s of %s has changed size",
+                                    where.c_str(), desc->getFieldName(f), desc->getName());
+        }
+        for (int i = 0; i < n; i++) {
+            if (flags & cClassDescriptor::FD_ISPOINTER) {
+                if (cMessage *child = getMessage())
+                    desc->setFieldStructValuePointer(obj, f, i, toAnyPtr(static_cast<cObject *>(child)));
+            }
+            else if (flags & cClassDescriptor::FD_ISCOMPOUND) {
+                getFields(desc->getFieldStructValuePointer(obj, f, i),
+                          cClassDescriptor::getDescriptorFor(desc->getFieldStructName(f)), 0);
+            }
+            else {
+                std::string value = isAbsoluteTime(desc, f) ? getTime().str() : getString();
+                desc->setFieldValueAsString(obj, f, i, value.c_str());
+            }
+        }
+    }
+}
+
+void CheckpointReader::getInFlight(cSimpleModule *module) {
+    uint64_t n = getUint();
+    for (uint64_t k = 0; k < n; k++) {
+        std::string gateName = getString();
+        int index = getInt();
+        simtime_t t = getTime();
+        short priority = getInt();
+        cMessage *msg = getMessage();
+        cGate *g = module->gate(gateName.c_str(), index);
+
+        // What send() over the gate's path would have done at the sender
+        msg->setSchedulingPriority(priority);
+        msg->setArrival(module->getId(), g->getId(), t);
+        getSimulation()->insertEvent(msg);
+    }
+}
+
+Checkpoint& Checkpoint::instance() {
+    static Checkpoint checkpoint;
+    return checkpoint;
+}
+
+cMessage *Checkpoint::attach(cSimpleModule *module, Checkpointed *state) {
+    if (!listening) {
+        getEnvir()->addLifecycleListener(this);
+        listening = true;
+    }
+    if (attached++ == 0) {
+        cConfiguration *cfg = getEnvir()->getConfig();
+        at = cfg ? cfg->getAsDouble(CFGID_DHCP_CHECKPOINT_AT, -1) : -1;
+        fileName = cfg && at >= SIMTIME_ZERO ? cfg->getAsFilename(CFGID_DHCP_CHECKPOINT_FILE) : "";
+        resumeFile = cfg ? cfg->getAsFilename(CFGID_DHCP_RESUME_FROM) : "";
+        timerGiven = false;
+        restored = 0;
+        members.clear();
+        sections.clear();
+
+        // Every partition would only see its own part of the network
+        if ((at >= SIMTIME_ZERO || !resumeFile.empty()) && getEnvir()->getParsimNumPartitions() > 1)
+            throw cRuntimeError("dhcp-checkpoint-at and dhcp-resume-from do not work under parallel simulation");
+        if (!resumeFile.empty())
+            readFile();
+    }
+    members.push_back({module, state});
+
+    if (!resumeFile.empty()) {
+        std::string path = module->getFullPath();
+        auto it = sections.find(path);
+        if (it == sections.end())
+            throw cRuntimeError("Checkpoint %s has no state for %s", resumeFile.c_str(), path.c_str());
+        CheckpointReader in(it->second, path.c_str());
+        std::string type = in.getString();
+        if (type != module->getNedTypeName())
+            throw cRuntimeError("Checkpoint %s holds a %s as %s, not a %s", resumeFile.c_str(),
+                                type.c_str(), path.c_str(), module->getNedTypeName());
+        state->restoreState(in);
+        if (!in.atEnd())
+            throw cRuntimeError("Checkpoint state of %s was not read to the end", path.c_str());
+        restored++;
+    }
+
+    if (at < SIMTIME_ZERO || timerGiven) return nullptr;
+    timerGiven = true;
+    cMessage *timer = new cMessage("checkpoint");
+    module->scheduleAt(at, timer);
+    return timer;
+}
+
+void Checkpoint::detach(Checkpointed *state) {
+    members.erase(std::remove_if(members.begin(), members.end(),
+                                 [state](const Member& m) { return m.state == state; }),
+                  members.end());
+    if (attached == 0 || --attached > 0) return;
+    if (restored < sections.size())
+        EV << "WARN: " << sections.size() - restored << " modules of checkpoint "
+           << resumeFile << " are not in this network\n";
+    sections.clear();
+    members.clear();
+    at = -1;
+}
+
+void Checkpoint::lifecycleEvent(SimulationLifecycleEventType type, cObject *details) {
+    if (type != LF_PRE_NETWORK_DELETE || attached == 0) return;
+    attached = 0;
+    members.clear();
+    sections.clear();
+    at = -1;
+    resumeFile.clear();
+}
+
+void Checkpoint::refuse(cComponent *module) {
+    cConfiguration *cfg = getEnvir()->getConfig();
+    if (!cfg) return;
+    if (cfg->getAsDouble(CFGID_DHCP_CHECKPOINT_AT, -1) >= 0 || !cfg->getAsFilename(CFGID_DHCP_RESUME_FROM).empty())
+        throw cRuntimeError("A %s cannot be checkpointed; dhcp-checkpoint-at and dhcp-resume-from "
+                            "only work on networks of Switch, DHCP and Device modules", module->getNedTypeName());
+}
+
+void Checkpoint::take() {
+    CheckpointWriter out;
+    out.putUint(CHECKPOINT_MAGIC);
+    out.putUint(CHECKPOINT_VERSION);
+    out.putInt(SimTime::getScaleExp());
+    out.putInt(simTime().raw());
+    out.putUint(members.size());
+    for (const Member& m : members) {
+        CheckpointWriter section;
+        section.putString(m.module->getNedTypeName());
+        m.state->saveState(section);
+        out.putString(m.module->getFullPath());
+        out.putString(section.data());
+    }
+
+    FILE *f = fopen(fileName.c_str(), "wb");
+    bool ok = f && fwrite(out.data().data(), 1, out.data().size(), f) == out.data().size();
+    if (f && fclose(f) != 0) ok = false;
+    if (!ok)
+        throw cRuntimeError("Cannot write checkpoint %s", fileName.c_str());
+    EV << "INFO: [" << simTime() << "] checkpoint of " << members.size() << " modules written to "
+       << fileName << " (" << out.data().size() << " bytes)\n";
+}
+
+void Checkpoint::readFile() {
+    FILE *f = fopen(resumeFile.c_str(), "rb");
+    if (!f)
+        throw cRuntimeError("Cannot open checkpoint %s", resumeFile.c_str());
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+        data.append(chunk, n);
+    fclose(f);
+
+    CheckpointReader in(data, resumeFile.c_str());
+    if (in.getUint() != CHECKPOINT_MAGIC || in.getUint() != CHECKPOINT_VERSION)
+        throw cRuntimeError("%s is not a checkpoint of this version", resumeFile.c_str());
+    int scaleExp = in.getInt();
+    if (scaleExp != SimTime::getScaleExp())
+        throw cRuntimeError("Checkpoint %s was taken with simtime-resolution 10^%d, not 10^%d",
+                            resumeFile.c_str(), scaleExp, SimTime::getScaleExp());
+    simtime_t takenAt = SimTime::fromRaw(in.getInt());
+    uint64_t count = in.getUint();
+    for (uint64_t i = 0; i < count; i++) {
+        std::string path = in.getString();
+        sections[path] = in.getString();
+    }
+    EV << "INFO: resuming " << count << " modules from checkpoint " << resumeFile
+       << " taken at t=" << takenAt << "s\n";
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <omnetpp.h>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "Ip6Address.h"
+
+// ============================================================================
+// CHECKPOINT
+// Saves the state of a warmed-up run so that other runs can start from it
+// instead of replaying the warm-up. With dhcp-checkpoint-at set, the state
+// of every checkpointed module is written to dhcp-checkpoint-file in one
+// event at that time: tables, pool cursors, the remaining time of every
+// timer and the frames on their way to the module. A run with
+// dhcp-resume-from restores each module from its section at the end of
+// its initialize(), so any parameter that only acts later, failureTime and
+// recoveryTime above all, may differ from the run that wrote the file.
+// Times are stored relative to the checkpoint: the resumed run's time zero
+// is the checkpoint instant. Counters and statistics start from zero and
+// the random number streams are those of a fresh run. Sections are keyed
+// by module path; numbers are written in host byte order.
+// ============================================================================
+
+class CheckpointWriter {
+  public:
+    void putInt(int64_t v) { putRaw(&v, sizeof(v)); }
+    void putUint(uint64_t v) { putRaw(&v, sizeof(v)); }
+    void putDouble(double v) { putRaw(&v, sizeof(v)); }
+    void putBool(bool v) { putInt(v); }
+    void putString(const std::string& s) {
+        putUint(s.size());
+        putRaw(s.data(), s.size());
+    }
+    void putUints(const std::vector<uint64_t>& v) {
+        putUint(v.size());
+        putRaw(v.data(), v.size() * sizeof(uint64_t));
+    }
+    void putAddress(const Ip6Address& a) {
+        putUint(a.hi);
+        putUint(a.lo);
+    }
+
+    // A point in time, relative to the checkpoint instant, or a duration
+    void putTime(omnetpp::simtime_t t) { putInt((t - omnetpp::simTime()).raw()); }
+    void putDuration(omnetpp::simtime_t d) { putInt(d.raw()); }
+
+    // Whether the timer is scheduled and for when; timer may be null
+    void putTimer(const omnetpp::cMessage *timer);
+
+    // A message with its name, kind and the fields of its own class; null
+    // is allowed
+    void putMessage(const omnetpp::cMessage *msg);
+
+    // Every frame in the future event set that is still on its way to module
+    void putInFlight(const omnetpp::cModule *module);
+
+    const std::string& data() const { return buf; }
+
+  private:
+    std::string buf;
+
+    void putRaw(const void *p, size_t n) { buf.append((const char *)p, n); }
+    void putFields(omnetpp::any_ptr obj, omnetpp::cClassDescriptor *desc, int firstField);
+};
+
+class CheckpointReader {
+  public:
+    CheckpointReader(const std::string& section, const char *path) : buf(section), where(path) {}
+
+    int64_t getInt() { int64_t v; getRaw(&v, sizeof(v)); return v; }
+    uint64_t getUint() { uint64_t v; getRaw(&v, sizeof(v)); return v; }
+    double getDouble() { double v; getRaw(&v, sizeof(v)); return v; }
+    bool getBool() { return getInt() != 0; }
+    std::string getString();
+    std::vector<uint64_t> getUints() {
+        std::vector<uint64_t> v(getUint());
+        getRaw(v.data(), v.size() * sizeof(uint64_t));
+        return v;
+    }
+    Ip6Address getAddress() {
+        uint64_t hi = getUint();
+        return Ip6Address(hi, getUint());
+    }
+    omnetpp::simtime_t getTime() { return omnetpp::simTime() + omnetpp::SimTime::fromRaw(getInt()); }
+    omnetpp::simtime_t getDuration() { return omnetpp::SimTime::fromRaw(getInt()); }
+
+    // Reschedules timer as it was saved, or cancels it; with a null timer
+    // the entry is skipped
+    void getTimer(omnetpp::cSimpleModule *module, omnetpp::cMessage *timer);
+
+    // The caller owns the message; null if null was saved
+    omnetpp::cMessage *getMessage();
+
+    // Puts the saved frames back into the future event set, arriving at
+    // module on their gates at their times
+    void getInFlight(omnetpp::cSimpleModule *module);
+
+    bool atEnd() const { return pos == buf.size(); }
+
+  private:
+    const std::string& buf;
+    size_t pos = 0;
+    std::string where;
+
+    void getRaw(void *p, size_t n) {
+        if (n > buf.size() - pos)
+            throw omnetpp::cRuntimeError("Checkpoint section of %s is truncated", where.c_str());
+        memcpy(p, buf.data() + pos, n);
+        pos += n;
+    }
+    void getFields(omnetpp::any_ptr obj, omnetpp::cClassDescriptor *desc, int firstField);
+};
+
+// Implemented by every module that takes part in checkpoints
+class Checkpointed {
+  public:
+    virtual ~Checkpointed() {}
+    virtual void saveState(CheckpointWriter& out) = 0;
+    virtual void restoreState(CheckpointReader& in) = 0;
+};
+
+class Checkpoint : public omnetpp::cISimulationLifecycleListener {
+  public:
+    static Checkpoint& instance();
+
+    // Every checkpointed module attaches at the end of initialize() and
+    // detaches in finish(). The first attach of a run reads the
+    // configuration and the file to resume from; a resumed module is
+    // restored right away. The one module that gets a timer back hands it
+    // to take() when it fires and deletes it in finish().
+    omnetpp::cMessage *attach(omnetpp::cSimpleModule *module, Checkpointed *state);
+    void detach(Checkpointed *state);
+
+    // Writes the state of every attached module
+    void take();
+
+    // For modules whose state is not checkpointed: an error if the run
+    // takes or resumes from a checkpoint
+    static void refuse(omnetpp::cComponent *module);
+
+  protected:
+    // Forgets the members of a network deleted without finish(), e.g.
+    // after an error, so the next run does not see them
+    virtual void lifecycleEvent(omnetpp::SimulationLifecycleEventType type, omnetpp::cObject *details) override;
+    virtual void listenerRemoved() override { listening = false; }
+
+  private:
+    struct Member {
+        omnetpp::cSimpleModule *module;
+        Checkpointed *state;
+    };
+    std::vector<Member> members;
+    int attached = 0;
+    bool listening = false;
+    omnetpp::simtime_t at = -1;   // negative = no checkpoint
+    std::string fileName;
+    bool timerGiven = false;
+    std::map<std::string, std::string> sections;  // module path -> saved state, when resuming
+    std::string resumeFile;
+    size_t restored = 0;
+
+    void readFile();
+};
@@ -0,0 +1,495 @@
+#include <omnetpp.h>
+#include <string>
+#include <vector>
+#include <queue>
+#include <climits>
+#include "helpers.h"
+#include "ArrivalProcess.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "Checkpoint.h"
+
+using namespace omnetpp;
+using std::string;
+using std::vector;
+
+// ============================================================================
+// CLIENT POPULATION
+// Many logical DHCPv6 clients behind one gate, for runs where a Device
+// module per client costs too much. Each client speaks the same protocol
+// as Device (SOLICIT/ADVERTISE/REQUEST/REPLY with Rapid Commit, RENEW and
+// REBIND at T1/T2, RFC 8415 retransmission) under its own client id,
+// firstClientId + index. Client state is kept as one array per field and
+// every client timer lives in a single calendar behind one self-message.
+// Releases and the Device start-order scheme are not modelled.
+// ============================================================================
+class ClientPopulation : public cSimpleModule {
+  private:
+    enum State : uint8_t { INIT, SELECTING, REQUESTING, BOUND, RENEWING, REBINDING };
+    enum Timer : uint8_t { TIMER_LEASE, TIMER_RETRANSMIT };
+
+    struct Backoff {
+        simtime_t irt, mrt, mrd;
+        int mrc;
+    };
+
+    int numClients = 0;
+    int firstClientId = 0;
+    bool rapidCommit = false;
+    Backoff solicitBackoff, requestBackoff, renewBackoff, rebindBackoff;
+
+    // Per-client state, structure of arrays indexed by client
+    vector<uint8_t> state;
+    vector<uint8_t> devClass;
+    vector<uint8_t> priority;
+    vector<uint16_t> transmissions;
+    vector<uint8_t> handshakeRetransmissions;
+    vector<uint8_t> handshakeMessages;
+    vector<bool> isVip;
+    vector<bool> completed;        // bound at least once
+    vector<int> serverId;
+    vector<Ip6Address> address;    // offered, then bound
+    vector<simtime_t> t2;
+    vector<simtime_t> leaseExpiry;
+    vector<simtime_t> leaseAt;     // pending start/T1/T2/expiry, -1 = none
+    vector<simtime_t> retransAt;   // pending retransmission, -1 = none
+    vector<simtime_t> rt;          // current retransmission timeout
+    vector<simtime_t> exchangeStart;
+    vector<simtime_t> transactionStart;
+
+    // Event calendar. An entry is live only while it matches the client's
+    // leaseAt or retransAt; re-arming or cancelling a timer just leaves the
+    // old entry to be skipped when it comes up.
+    struct Entry {
+        simtime_t at;
+        uint64_t order;            // FIFO among equal times
+        int client;
+        Timer timer;
+        bool operator>(const Entry& o) const {
+            return at > o.at || (at == o.at && order > o.order);
+        }
+    };
+    std::priority_queue<Entry, vector<Entry>, std::greater<Entry>> calendar;
+    uint64_t nextOrder = 0;
+    cMessage *calendarTimer = nullptr;
+
+    // Signals
+    simsignal_t handshakeLatencySignal;
+    simsignal_t vipLatencySignal;
+    simsignal_t normalLatencySignal;
+    simsignal_t retransmissionSignal;
+    simsignal_t handshakeRetransmissionsSignal;
+    simsignal_t handshakeMessagesSignal;
+    simsignal_t rapidCommitLatencySignal;
+    simsignal_t fourMessageLatencySignal;
+
+    // Statistics, over all clients
+    long solicitsSent = 0;
+    long advertisesReceived = 0;
+    long requestsSent = 0;
+    long repliesReceived = 0;
+    long renewsSent = 0;
+    long rebindsSent = 0;
+    long leasesLost = 0;       // bindings ended early: refused renewal or expiry
+    long requestsRefused = 0;  // REQUESTs answered without a binding
+    long retransmissions = 0;
+    long requestsAbandoned = 0;
+    long rapidCommits = 0;
+    long clientsCompleted = 0;
+    long staleEntries = 0;
+
+    EventProfile profile;  // with dhcp-profile
+
+  protected:
+    virtual void initialize() override {
+        Checkpoint::refuse(this);  // the client table is not saved
+        numClients = par("numClients").intValue();
+        firstClientId = par("firstClientId").intValue();
+        if (numClients < 0 || firstClientId <= 0 || (int64_t)firstClientId + numClients > INT_MAX)
+            throw cRuntimeError("Client ids %d..%d do not fit in an int", firstClientId,
+                                firstClientId + numClients - 1);
+        int clientIdSpan = par("clientIdSpan").intValue();
+        if (clientIdSpan > 0 && numClients > clientIdSpan)
+            throw cRuntimeError("%d clients overflow the %d ids set aside for this population, "
+                                "they would share ids with the next one", numClients, clientIdSpan);
+        rapidCommit = par("rapidCommit").boolValue();
+        int vipPriorityCutoff = par("vipPriorityCutoff").intValue();
+        solicitBackoff = readBackoff("sol");
+        requestBackoff = readBackoff("req");
+        renewBackoff = readBackoff("ren");
+        rebindBackoff = readBackoff("reb");
+        TraceRing::instance().attach();
+        profile.init();
+
+        handshakeLatencySignal = registerSignal("handshakeLatency");
+        vipLatencySignal = registerSignal("vipHandshakeLatency");
+        normalLatencySignal = registerSignal("normalHandshakeLatency");
+        retransmissionSignal = registerSignal("retransmission");
+        handshakeRetransmissionsSignal = registerSignal("handshakeRetransmissions");
+        handshakeMessagesSignal = registerSignal("handshakeMessages");
+        rapidCommitLatencySignal = registerSignal("rapidCommitLatency");
+        fourMessageLatencySignal = registerSignal("fourMessageLatency");
+
+        state.assign(numClients, INIT);
+        devClass.resize(numClients);
+        priority.resize(numClients);
+        transmissions.assign(numClients, 0);
+        handshakeRetransmissions.assign(numClients, 0);
+        handshakeMessages.assign(numClients, 0);
+        isVip.resize(numClients);
+        completed.assign(numClients, false);
+        serverId.assign(numClients, 0);
+        address.assign(numClients, Ip6Address());
+        t2.resize(numClients);
+        leaseExpiry.resize(numClients);
+        leaseAt.assign(numClients, -1);
+        retransAt.assign(numClients, -1);
+        rt.resize(numClients);
+        exchangeStart.resize(numClients);
+        transactionStart.resize(numClients);
+
+        // Same type mix as ScalableDhcpNet; routers get the remainder
+        int pc = par("pcPercent").intValue();
+        int mobile = pc + par("mobilePercent").intValue();
+        int printer = mobile + par("printerPercent").intValue();
+        int server = printer + par("serverPercent").intValue();
+        // Start times from the arrival process if one is set, else startTime
+        ArrivalProcess arrivals;
+        arrivals.init(this);
+        int arrivalIndex = par("arrivalIndex").intValue();
+        calendarTimer = new cMessage("calendar");
+        for (int i = 0; i < numClients; i++) {
+            int slot = i % 100;
+            devClass[i] = slot < pc ? DEVCLASS_PC : slot < mobile ? DEVCLASS_MOBILE :
+                          slot < printer ? DEVCLASS_PRINTER : slot < server ? DEVCLASS_SERVER :
+                          DEVCLASS_ROUTER;
+            if (arrivals.traceClass(arrivalIndex + i) >= 0)
+                devClass[i] = arrivals.traceClass(arrivalIndex + i);
+            priority[i] = par("priority").intValue();
+            isVip[i] = isVipClass(devClass[i], priority[i], vipPriorityCutoff);
+            simtime_t at = arrivals.isSet() ? arrivals.startTime(arrivalIndex + i)
+                                            : simTime() + par("startTime").doubleValue();
+            if (at >= SIMTIME_ZERO)
+                arm(i, TIMER_LEASE, at);
+        }
+
+        DLOG_INFO << "INFO: " << getFullName() << " simulates " << numClients
+                  << " clients, ids " << firstClientId << ".." << firstClientId + numClients - 1 << "\n";
+    }
+
+    virtual void handleMessage(cMessage *msg) override {
+        DHCP_PROFILE_EVENT(profile, msg);
+        if (msg == calendarTimer) {
+            runCalendar();
+            return;
+        }
+
+        auto *dmsg = check_and_cast<DhcpMessage *>(msg);
+        int i = DST(dmsg) - firstClientId;
+        if (i < 0 || i >= numClients) {
+            delete msg;  // broadcast from another client, or not ours
+            return;
+        }
+        DHCP_TRACE_MSG(this, msg);
+
+        if (msg->getKind() == DHCPV6_ADVERTISE)
+            handleAdvertise(i, check_and_cast<DhcpAdvertise *>(msg));
+        else if (msg->getKind() == DHCPV6_REPLY)
+            handleReply(i, check_and_cast<DhcpReply *>(msg));
+        delete msg;
+    }
+
+    // Calendar
+
+    void arm(int i, Timer timer, simtime_t at) {
+        (timer == TIMER_LEASE ? leaseAt : retransAt)[i] = at;
+        calendar.push({at, nextOrder++, i, timer});
+        if (!calendarTimer->isScheduled() || calendarTimer->getArrivalTime() > at)
+            rescheduleAt(at, calendarTimer);
+    }
+
+    void runCalendar() {
+        while (!calendar.empty() && calendar.top().at <= simTime()) {
+            Entry e = calendar.top();
+            calendar.pop();
+            simtime_t& pending = (e.timer == TIMER_LEASE ? leaseAt : retransAt)[e.client];
+            if (pending != e.at) {
+                staleEntries++;
+                continue;
+            }
+            pending = -1;
+            if (e.timer == TIMER_LEASE)
+                leaseTimer(e.client);
+            else
+                retransmit(e.client);
+        }
+        if (!calendar.empty())
+            rescheduleAt(calendar.top().at, calendarTimer);
+    }
+
+    // Client protocol, as in Device
+
+    int clientId(int i) const { return firstClientId + i; }
+
+    void startSolicit(int i) {
+        state[i] = SELECTING;
+        transactionStart[i] = simTime();
+        handshakeRetransmissions[i] = 0;
+        handshakeMessages[i] = 0;
+        transmit(i, buildMessage(i));
+        solicitsSent++;
+    }
+
+    void handleAdvertise(int i, DhcpAdvertise *adv) {
+        advertisesReceived++;
+        if (state[i] != SELECTING) return;
+        handshakeMessages[i]++;
+        serverId[i] = adv->getServerId() ? adv->getServerId() : SRC(adv);
+        address[i] = adv->getAddress();
+        state[i] = REQUESTING;
+        transmit(i, buildMessage(i));
+        requestsSent++;
+    }
+
+    void handleReply(int i, DhcpReply *rep) {
+        repliesReceived++;
+        bool committed = state[i] == SELECTING && rep->getRapidCommit();
+        if (state[i] != REQUESTING && state[i] != RENEWING && state[i] != REBINDING && !committed)
+            return;  // a stray duplicate
+        retransAt[i] = -1;
+
+        if (rep->getValidLifetime() == SIMTIME_ZERO) {
+            if (state[i] == RENEWING || state[i] == REBINDING) {
+                loseLease(i);
+            }
+            else {
+                requestsRefused++;  // nothing was bound yet
+                address[i] = Ip6Address();
+                startSolicit(i);
+            }
+            return;
+        }
+
+        bool renewal = state[i] == RENEWING || state[i] == REBINDING;
+        address[i] = rep->getAddress();
+        serverId[i] = rep->getServerId() ? rep->getServerId() : SRC(rep);
+        state[i] = BOUND;
+        t2[i] = simTime() + rep->getPreferredLifetime() * 0.8;
+        leaseExpiry[i] = simTime() + rep->getValidLifetime();
+        arm(i, TIMER_LEASE, simTime() + rep->getPreferredLifetime() * 0.5);
+        if (renewal) return;
+
+        handshakeMessages[i]++;
+        if (committed) rapidCommits++;
+        if (!completed[i]) {
+            completed[i] = true;
+            clientsCompleted++;
+        }
+        simtime_t latency = simTime() - transactionStart[i];
+        emit(handshakeLatencySignal, latency);
+        emit(isVip[i] ? vipLatencySignal : normalLatencySignal, latency);
+        emit(committed ? rapidCommitLatencySignal : fourMessageLatencySignal, latency);
+        emit(handshakeRetransmissionsSignal, (long)handshakeRetransmissions[i]);
+        emit(handshakeMessagesSignal, (long)handshakeMessages[i]);
+    }
+
+    void leaseTimer(int i) {
+        switch (state[i]) {
+            case INIT:
+                startSolicit(i);
+                break;
+            case BOUND:
+                state[i] = RENEWING;
+                transactionStart[i] = simTime();
+                transmit(i, buildMessage(i));
+                renewsSent++;
+                arm(i, TIMER_LEASE, t2[i]);
+                break;
+            case RENEWING:
+                state[i] = REBINDING;
+                transmit(i, buildMessage(i));
+                rebindsSent++;
+                arm(i, TIMER_LEASE, leaseExpiry[i]);
+                break;
+            case REBINDING:
+                loseLease(i);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void loseLease(int i) {
+        leasesLost++;
+        address[i] = Ip6Address();
+        leaseAt[i] = -1;
+        startSolicit(i);
+    }
+
+    // The message of the exchange the client is in; retransmissions are
+    // rebuilt from the client's state instead of keeping a copy
+    DhcpMessage *buildMessage(int i) {
+        switch (state[i]) {
+            case SELECTING: {
+                auto *sol = mk<DhcpSolicit>("DHCPV6_SOLICIT", DHCPV6_SOLICIT, clientId(i), 0);
+                sol->setDeviceClass(devClass[i]);
+                sol->setPriority(priority[i]);
+                sol->setRapidCommit(rapidCommit);
+                return sol;
+            }
+            case REQUESTING: {
+                auto *req = mk<DhcpRequest>("DHCPV6_REQUEST", DHCPV6_REQUEST, clientId(i), serverId[i]);
+                req->setAddress(address[i]);
+                req->setPriority(priority[i]);
+                return req;
+            }
+            case RENEWING: {
+                auto *ren = mk<DhcpRenew>("DHCPV6_RENEW", DHCPV6_RENEW, clientId(i), serverId[i]);
+                ren->setAddress(address[i]);
+                ren->setPriority(priority[i]);
+                return ren;
+            }
+            default: {
+                auto *reb = mk<DhcpRebind>("DHCPV6_REBIND", DHCPV6_REBIND, clientId(i), 0);
+                reb->setAddress(address[i]);
+                reb->setPriority(priority[i]);
+                return reb;
+            }
+        }
+    }
+
+    Backoff readBackoff(const char *prefix) {
+        string p = prefix;
+        Backoff b;
+        b.irt = par((p + "Timeout").c_str()).doubleValue();
+        b.mrt = par((p + "MaxRt").c_str()).doubleValue();
+        b.mrc = par((p + "MaxRc").c_str()).intValue();
+        b.mrd = par((p + "MaxRd").c_str()).doubleValue();
+        return b;
+    }
+
+    // Limits of the exchange a client is in; RENEW only runs until T2 and
+    // REBIND until the lease expires
+    Backoff limitsOf(int i) const {
+        Backoff b;
+        simtime_t bound = -1;
+        switch (state[i]) {
+            case SELECTING:  b = solicitBackoff; break;
+            case REQUESTING: b = requestBackoff; break;
+            case RENEWING:   b = renewBackoff; bound = t2[i] - exchangeStart[i]; break;
+            default:         b = rebindBackoff; bound = leaseExpiry[i] - exchangeStart[i]; break;
+        }
+        if (bound > SIMTIME_ZERO && (b.mrd == SIMTIME_ZERO || bound < b.mrd))
+            b.mrd = bound;
+        return b;
+    }
+
+    void transmit(int i, DhcpMessage *msg) {
+        exchangeStart[i] = simTime();
+        transmissions[i] = 1;
+        Backoff b = limitsOf(i);
+
+        // The first SOLICIT timeout must be strictly greater than IRT
+        double rand = msg->getKind() == DHCPV6_SOLICIT ? uniform(0, 0.1) : uniform(-0.1, 0.1);
+        rt[i] = b.irt + rand * b.irt;
+
+        msg->setElapsedTime(elapsedHundredths(i));
+        if (msg->getKind() == DHCPV6_SOLICIT || msg->getKind() == DHCPV6_REQUEST)
+            handshakeMessages[i]++;
+        if (b.irt > SIMTIME_ZERO)
+            scheduleRetransmission(i, b);
+        else
+            retransAt[i] = -1;
+        send(msg, "ppp$o");
+    }
+
+    void scheduleRetransmission(int i, const Backoff& b) {
+        simtime_t at = simTime() + rt[i];
+        if (b.mrd > SIMTIME_ZERO && at > exchangeStart[i] + b.mrd)
+            at = exchangeStart[i] + b.mrd;
+        arm(i, TIMER_RETRANSMIT, at);
+    }
+
+    void retransmit(int i) {
+        Backoff b = limitsOf(i);
+        bool outOfTries = b.mrc > 0 && transmissions[i] >= b.mrc;
+        bool outOfTime = b.mrd > SIMTIME_ZERO && simTime() >= exchangeStart[i] + b.mrd;
+        if (outOfTries || outOfTime) {
+            // RENEW and REBIND just go quiet until the next lease timer
+            if (state[i] == REQUESTING) {
+                requestsAbandoned++;
+                startSolicit(i);
+            }
+            return;
+        }
+
+        rt[i] = 2 * rt[i] + uniform(-0.1, 0.1) * rt[i];
+        if (b.mrt > SIMTIME_ZERO && rt[i] > b.mrt)
+            rt[i] = b.mrt + uniform(-0.1, 0.1) * b.mrt;
+
+        DhcpMessage *msg = buildMessage(i);
+        msg->setElapsedTime(elapsedHundredths(i));
+        short kind = msg->getKind();
+        send(msg, "ppp$o");
+        if (transmissions[i] < UINT16_MAX) transmissions[i]++;
+        retransmissions++;
+        if (state[i] == SELECTING || state[i] == REQUESTING) {
+            if (handshakeRetransmissions[i] < UINT8_MAX) handshakeRetransmissions[i]++;
+            if (handshakeMessages[i] < UINT8_MAX) handshakeMessages[i]++;
+        }
+        emit(retransmissionSignal, (long)kind);
+        scheduleRetransmission(i, b);
+    }
+
+    uint16_t elapsedHundredths(int i) const {
+        double cs = (simTime() - transactionStart[i]).dbl() * 100;
+        return cs >= 0xffff ? 0xffff : (uint16_t)cs;
+    }
+
+    virtual void finish() override {
+        cancelAndDelete(calendarTimer);
+        calendarTimer = nullptr;
+        TraceRing::instance().detach();
+        profile.finish(this);
+
+        long bound = 0;
+        for (int i = 0; i < numClients; i++)
+            if (state[i] == BOUND || state[i] == RENEWING || state[i] == REBINDING) bound++;
+
+        DLOG_INFO << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "CLIENT POPULATION STATISTICS: " << getFullName() << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "Clients          : " << numClients << " (" << clientsCompleted
+                  << " completed, " << bound << " bound at end)\n";
+        DLOG_INFO << "SOLICIT sent     : " << solicitsSent << "\n";
+        DLOG_INFO << "ADVERTISE recv   : " << advertisesReceived << "\n";
+        DLOG_INFO << "REQUEST sent     : " << requestsSent << "\n";
+        DLOG_INFO << "REPLY received   : " << repliesReceived << "\n";
+        DLOG_INFO << "RENEW/REBIND sent: " << renewsSent << "/" << rebindsSent << "\n";
+        DLOG_INFO << "Leases lost      : " << leasesLost << "\n";
+        DLOG_INFO << "REQUEST refused  : " << requestsRefused << "\n";
+        DLOG_INFO << "Rapid commits    : " << rapidCommits << "\n";
+        DLOG_INFO << "Retransmissions  : " << retransmissions
+                  << " (" << requestsAbandoned << " REQUEST exchanges abandoned)\n";
+        DLOG_INFO << "Calendar entries : " << nextOrder << " (" << staleEntries << " skipped as stale)\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "\n";
+
+        recordScalar("clients", numClients);
+        recordScalar("clientsCompleted", clientsCompleted);
+        recordScalar("clientsBound", bound);
+        recordScalar("solicitsSent", solicitsSent);
+        recordScalar("requestsSent", requestsSent);
+        recordScalar("renewsSent", renewsSent);
+        recordScalar("rebindsSent", rebindsSent);
+        recordScalar("leasesLost", leasesLost);
+        recordScalar("requestsRefused", requestsRefused);
+        recordScalar("retransmissions", retransmissions);
+        recordScalar("requestsAbandoned", requestsAbandoned);
+        recordScalar("rapidCommits", rapidCommits);
+        recordScalar("calendarEntries", nextOrder);
+    }
+};
+
+Define_Module(ClientPopulation);
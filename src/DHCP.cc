@@ -1,31 +1,186 @@
 #include <omnetpp.h>
 #include <string>
 #include <unordered_map>
-#include <map>
-#include <sstream>
-#include <iomanip>
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <chrono>
+#include <climits>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 #include "helpers.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "AddressPool.h"
+#include "TimingWheel.h"
+#include "ServiceQueue.h"
+#include "FailureDetector.h"
+#include "LeaseStore.h"
+#include "LeaseIndex.h"
+#include "ShardRing.h"
+#include "Checkpoint.h"
 
 using namespace omnetpp;
 using std::string;
 using std::unordered_map;
-using std::map;
+using std::vector;
 
 // ============================================================================
 // SWITCH
 // ============================================================================
-class Switch : public cSimpleModule {
+class Switch : public cSimpleModule, public Checkpointed {
+  private:
+    struct FdbEntry {
+        int port;
+        simtime_t lastSeen;
+    };
+
+    // Learned source id -> port; entries older than agingTime count as unknown
+    unordered_map<int, FdbEntry> fdb;
+    simtime_t agingTime;
+    int connectedPorts = 0;
+
+    // Statistics, per output port
+    vector<long> forwardedPerPort;
+    vector<long> floodedPerPort;
+    long framesForwarded = 0;
+    long framesFlooded = 0;
+    long framesFiltered = 0;
+    long copiesSaved = 0;
+
+    EventProfile profile;  // with dhcp-profile
+    cMessage *checkpointTimer = nullptr;  // with dhcp-checkpoint-at
+
   protected:
+    virtual void initialize() override {
+        agingTime = par("agingTime").doubleValue();
+        forwardedPerPort.assign(gateSize("port"), 0);
+        floodedPerPort.assign(gateSize("port"), 0);
+        for (int i = 0; i < gateSize("port"); i++)
+            if (gate("port$o", i)->isConnected()) connectedPorts++;
+        profile.init();
+        checkpointTimer = Checkpoint::instance().attach(this, this);
+    }
+
     virtual void handleMessage(cMessage *msg) override {
+        DHCP_PROFILE_EVENT(profile, msg);
+        if (msg == checkpointTimer) {
+            Checkpoint::instance().take();
+            return;
+        }
+        auto *frame = check_and_cast<DhcpMessage *>(msg);
         int arrivalPort = msg->getArrivalGate()->getIndex();
-        int portCount = gateSize("port");
 
+        learn(SRC(frame), arrivalPort);
+
+        int outPort = DST(frame) == 0 ? -1 : lookup(DST(frame));
+        if (outPort == arrivalPort) {
+            // Destination sits behind the port it came from
+            framesFiltered++;
+            delete msg;
+        }
+        else if (outPort >= 0) {
+            framesForwarded++;
+            forwardedPerPort[outPort]++;
+            copiesSaved += connectedPorts - 2;
+            send(msg, "port$o", outPort);
+        }
+        else {
+            flood(msg, arrivalPort);
+        }
+    }
+
+    void learn(int srcId, int port) {
+        FdbEntry& e = fdb[srcId];
+        e.port = port;
+        e.lastSeen = simTime();
+    }
+
+    int lookup(int dstId) {
+        auto it = fdb.find(dstId);
+        if (it == fdb.end()) return -1;
+        if (simTime() - it->second.lastSeen > agingTime) {
+            fdb.erase(it);
+            return -1;
+        }
+        return it->second.port;
+    }
+
+    void flood(cMessage *msg, int arrivalPort) {
+        framesFlooded++;
+        int portCount = gateSize("port");
+        int lastPort = -1;
         for (int i = 0; i < portCount; i++) {
             if (i != arrivalPort && gate("port$o", i)->isConnected()) {
-                send(msg->dup(), "port$o", i);
+                if (lastPort >= 0) {
+                    send(msg->dup(), "port$o", lastPort);
+                    DHCP_PROFILE_DUPS(profile, 1);
+                    floodedPerPort[lastPort]++;
+                }
+                lastPort = i;
             }
         }
-        delete msg;
+        // The original goes out on the last port, saving one dup()
+        if (lastPort >= 0) {
+            send(msg, "port$o", lastPort);
+            floodedPerPort[lastPort]++;
+        }
+        else {
+            delete msg;
+        }
+    }
+
+    // The learned table and the frames on their way in
+    virtual void saveState(CheckpointWriter& out) override {
+        out.putUint(fdb.size());
+        for (const auto& entry : fdb) {
+            out.putInt(entry.first);
+            out.putInt(entry.second.port);
+            out.putTime(entry.second.lastSeen);
+        }
+        out.putInFlight(this);
+    }
+
+    virtual void restoreState(CheckpointReader& in) override {
+        fdb.clear();
+        for (uint64_t n = in.getUint(); n > 0; n--) {
+            FdbEntry& e = fdb[in.getInt()];
+            e.port = in.getInt();
+            e.lastSeen = in.getTime();
+        }
+        in.getInFlight(this);
+    }
+
+    virtual void finish() override {
+        cancelAndDelete(checkpointTimer);
+        checkpointTimer = nullptr;
+        Checkpoint::instance().detach(this);
+        for (int i = 0; i < (int)forwardedPerPort.size(); i++) {
+            char name[48];
+            snprintf(name, sizeof(name), "port[%d]:forwarded", i);
+            recordScalar(name, forwardedPerPort[i]);
+            snprintf(name, sizeof(name), "port[%d]:flooded", i);
+            recordScalar(name, floodedPerPort[i]);
+        }
+        recordScalar("framesForwarded", framesForwarded);
+        recordScalar("framesFlooded", framesFlooded);
+        recordScalar("framesFiltered", framesFiltered);
+        recordScalar("floodCopiesSaved", copiesSaved);
+        recordScalar("fdbSize", fdb.size());
+        profile.finish(this);
+
+        DLOG_INFO << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "SWITCH STATISTICS: " << getFullName() << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "Unicast forwarded: " << framesForwarded << "\n";
+        DLOG_INFO << "Flooded          : " << framesFlooded << "\n";
+        DLOG_INFO << "Filtered         : " << framesFiltered << "\n";
+        DLOG_INFO << "Copies saved     : " << copiesSaved << "\n";
+        DLOG_INFO << "Learned entries  : " << fdb.size() << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "\n";
     }
 };
 
@@ -34,101 +189,491 @@ Define_Module(Switch);
 // ============================================================================
 // DHCP SERVER
 // ============================================================================
-class DHCP : public cSimpleModule {
+class DHCP : public cSimpleModule, public Checkpointed {
   private:
-    string pcPrefix, mobilePrefix, printerPrefix, vipPrefix;
+    enum { POOL_PC, POOL_MOBILE, POOL_PRINTER, POOL_VIP, NUM_POOLS };
+    // The directly attached link's pools, then NUM_POOLS per relayed link:
+    // pool link * NUM_POOLS + class
+    vector<AddressPool> pools;
     double fastResponseDelay = 0.01;
     double normalResponseDelay = 0.02;
     int    vipPriorityCutoff = 9;
 
-    map<string, uint64_t> nextIdForPool;
-    unordered_map<long, string> addrTable;
+    struct Lease {
+        Ip6Address address;
+        simtime_t validUntil;
+        int64_t expiryTick = -1;  // wheel entry currently tracking this lease
+        bool peer = false;        // mirrored from the partner, not issued here
+        bool declined = false;    // quarantine entry, see quarantine()
+    };
+    struct Offer {
+        Ip6Address address;
+        int64_t expiryTick = -1;
+    };
+    unordered_map<int, Lease> addrTable;
+    LeaseIndex addrIndex;              // reverse of addrTable: who holds an address
+    unordered_map<int, Offer> offers;  // advertised, not yet requested
+
+    // Lease lifetimes; every lease and offer expiry lives in one wheel
+    enum { EXPIRE_LEASE, EXPIRE_OFFER };
+    simtime_t validLifetime;
+    simtime_t preferredLifetime;
+    simtime_t offerLifetime;
+    simtime_t declineHoldTime;
+    double expiryGranularity;
+    TimingWheel expiryWheel;
+    vector<TimingWheel::Entry> dueEntries;
+    cMessage *expiryTimer = nullptr;
+
+    // Change journal for delta replication to the partner
+    struct JournalEntry {
+        uint64_t seq;
+        int clientId;
+        Ip6Address address;  // unspecified = lease removed
+        simtime_t validUntil;
+        bool declined = false;
+    };
+    std::deque<JournalEntry> journal;
+    uint64_t journalSeq = 0;      // newest local change
+    uint64_t sentSeq = 0;         // newest change shipped to the partner
+    uint64_t peerAckedSeq = 0;    // newest change the partner confirmed
+    uint64_t peerAppliedSeq = 0;  // newest partner change applied here
+    bool resyncNeeded = false;    // a partner delta arrived with a gap
+    bool poolsDirty = false;
+    int syncJournalLimit;
 
+    // Local lease store for warm restarts. Changes are committed with every
+    // sync tick, before they are shipped, and compacted into a snapshot
+    // every leaseSnapshotInterval and at the end of the run.
+    LeaseStore store;
+    simtime_t leaseSnapshotInterval;
+    cMessage *snapshotTimer = nullptr;
+    double storeLoadTime = -1;    // wall-clock seconds of the last load
+    long storeLoadRecords = 0;
+    long storeLoadFaults = 0;
+    size_t storeLoadLeases = 0;
+    double catchupApplyTime = 0;  // wall-clock seconds spent applying catch-up chunks
+    int storeSnapshots = 0;
+
+    int hostId;             // own address in frames
     bool isPrimary;
     string partnerName;
+    bool loadBalancing;     // active-active: clients split by hash bucket
+    int primaryBuckets;     // buckets 0..primaryBuckets-1 belong to the primary
+    bool rapidCommitPool[NUM_POOLS] = {};  // honour Rapid Commit for these classes
+
+    // Relayed links 1..numLinks: link k is the k-th /62 of linkBase, its
+    // four /64s hold the link's pc, mobile, printer and VIP pools
+    Ip6Prefix linkBase;
+    int numLinks = 0;
+    vector<int> movedLinkPools;       // link pools allocated from since the last SYNC
+    vector<bool> linkPoolMoved;
+
+    // Where the answer to a client message goes: straight onto the
+    // segment, or back through the relay of a relayed link
+    struct Origin {
+        int relayId = 0;              // 0 = directly attached client
+        int link = 0;
+        Ip6Address linkAddress;
+        Ip6Address peerAddress;       // the client's, echoed to the relay
+    };
+    Origin origin;                    // of the message being answered
+    simtime_t frameOverhead;          // per received frame, on top of serviceTime
     double syncInterval;
-    double failoverTimeout;
+    double failoverTimeout;       // detection bound until the detector is calibrated
+    double heartbeatInterval;
+    double phiThreshold;
+    PhiAccrualDetector detector;  // over arrivals of any partner message
+    simtime_t lastSentToPartner;  // a SYNC doubles as a heartbeat
     double failureTime;
+    double recoveryTime;          // back this long after failing; negative = never
+    int catchupChunkSize;         // lease records per catch-up chunk
+    bool failback;                // a recovered primary takes the active role back
 
     bool isActive = false;
     bool partnerAlive = true;
+    bool partnerActive = true;    // as reported in the partner's last message
     simtime_t lastPartnerHeartbeat;
 
     cMessage *syncTimer = nullptr;
     cMessage *heartbeatTimer = nullptr;
-    cMessage *checkPartnerTimer = nullptr;
+    cMessage *suspectTimer = nullptr;  // due when phi would cross the threshold
     cMessage *failureEvent = nullptr;
+    cMessage *recoveryEvent = nullptr;
 
     bool hasFailed = false;
+    bool awaitingFailoverReply = false;  // took over, no REPLY sent yet
+    simtime_t partnerLastSeen;           // partner's last heartbeat at takeover
+
+    // Recovery: the returning server pulls the partner's table in chunks
+    // and answers no client until it has all of it
+    bool catchingUp = false;
+    simtime_t recoveredAt;
+    size_t catchupReceived = 0;          // records applied so far
+    uint64_t catchupFrom = 0;            // partner position of the local store, 0 = none
+    bool failbackPending = false;        // asked the partner for the active role
+    bool failbackAcked = false;
+    uint64_t failbackSeq = 0;            // partner journal position at hand-over
+
+    // Snapshot being streamed to a recovering partner, taken on its first request
+    vector<LeaseRecord> catchupSnapshot;
+    uint64_t catchupSeq = 0;
+
+    // Sharded cluster of clusterSize servers in place of the pair. Client
+    // ids are hashed onto shards and the shards onto the live members;
+    // each member answers the shards it owns, issues from its own slice
+    // of every pool and streams the changes of a shard to the members
+    // holding a copy of it.
+    bool clustered = false;
+    ShardRing ring;
+    int self = -1;                    // own member index
+    struct Peer {
+        bool alive = true;
+        simtime_t lastHeard;
+        simtime_t lastSent;           // any message doubles as a heartbeat
+        uint64_t sentSeq = 0;         // newest own change shipped to it
+        uint64_t ackedSeq = 0;        // newest own change it confirmed
+        uint64_t appliedSeq = 0;      // newest of its changes applied here
+        bool resyncNeeded = false;
+    };
+    vector<Peer> peers;               // by member index, the own entry unused
+    vector<simtime_t> shardReadyAt;   // a gained shard is answered once its leases arrived, or from then on
+    double joinTime;                  // a member that starts down joins then
+    long shardsMoved = 0;             // shard copies sent on membership changes
+    long leasesMoved = 0;
+    int membershipChanges = 0;
+
+    // Processing queue in front of serviceWorkers workers; with no workers
+    // every message is answered on arrival. Classes are ordered by rank.
+    enum { QCLASS_VIP, QCLASS_PC, QCLASS_MOBILE, QCLASS_PRINTER, NUM_QCLASSES };
+    struct Pending {
+        cMessage *msg = nullptr;
+        simtime_t arrival;
+        int cls = QCLASS_PC;
+        Origin origin;
+        simtime_t cost;               // service time, with the frame overhead if it came first
+    };
+    ServiceQueue<Pending> serviceQueue;
+    vector<cMessage *> workers;       // completion timer per worker, kind = index
+    vector<Pending> inService;
+    simtime_t serviceTime;
+    simtime_t queueingDelay;          // wait + service of the message being answered
+    long queueDrops[NUM_QCLASSES] = {};
+    long queueServed[NUM_QCLASSES] = {};
+
+    // Signals
+    simsignal_t queueLengthSignal[NUM_QCLASSES];
+    simsignal_t queueWaitSignal[NUM_QCLASSES];
+    simsignal_t queueDropSignal;
+    simsignal_t advertiseDelaySignal;
+    simsignal_t replyDelaySignal;
+    simsignal_t failoverGapSignal;
+    simsignal_t detectionTimeSignal;
+    simsignal_t syncSizeSignal;
+    simsignal_t leaseCountSignal;
+    simsignal_t catchupDurationSignal;
+    simsignal_t catchupLeasesSignal;
+    simsignal_t failbackTimeSignal;
+    simsignal_t leaseConflictSignal;
+    simsignal_t shardsMovedSignal;
+    size_t lastLeaseCount = 0;
+
+    // Rough wire size of a SYNC, for the syncSize statistic
+    static const int SYNC_HEADER_BYTES = 64;
+    static const int LEASE_RECORD_BYTES = 28;
 
     // Statistics
     int solicitsReceived = 0;
     int advertiseSent = 0;
     int requestsReceived = 0;
     int repliesSent = 0;
+    int renewsReceived = 0;
+    int rebindsReceived = 0;
+    int releasesReceived = 0;
+    int declinesReceived = 0;
+    int quarantinesLifted = 0;    // declined addresses back in their pool
+    int requestConflicts = 0;     // REQUESTs for an address bound to another client
+    int syncConflicts = 0;        // partner leases on an address bound here to another client
+    int staleSyncRecords = 0;     // partner records older than a client's binding issued here
+    int leasesExpired = 0;
+    int offersExpired = 0;
+    int syncsSent = 0;
+    int heartbeatsSent = 0;
+    int heartbeatsSuppressed = 0;
+    int syncsSkipped = 0;
+    int snapshotsSent = 0;
+    int rapidCommits = 0;
+    int recoveries = 0;
+    int catchupChunksSent = 0;
+    int catchupChunksReceived = 0;
+    long leaseRecordsSent = 0;
+    long relayFramesReceived = 0;
+    long relayedReceived = 0;
+    long relayRepliesSent = 0;
+
+    EventProfile profile;  // with dhcp-profile
+    cMessage *checkpointTimer = nullptr;  // with dhcp-checkpoint-at
 
   protected:
     virtual void initialize() override {
-        pcPrefix       = par("pcPrefix").stringValue();
-        mobilePrefix   = par("mobilePrefix").stringValue();
-        printerPrefix  = par("printerPrefix").stringValue();
-        vipPrefix      = par("vipPrefix").stringValue();
         fastResponseDelay   = par("fastResponseDelay").doubleValue();
         normalResponseDelay = par("normalResponseDelay").doubleValue();
         vipPriorityCutoff   = par("vipPriorityCutoff").intValue();
+        validLifetime       = par("validLifetime").doubleValue();
+        preferredLifetime   = par("preferredLifetime").doubleValue();
+        offerLifetime       = par("offerLifetime").doubleValue();
+        declineHoldTime     = par("declineHoldTime").doubleValue();
+        expiryGranularity   = par("expiryGranularity").doubleValue();
+        if (preferredLifetime > validLifetime)
+            throw cRuntimeError("preferredLifetime must not exceed validLifetime");
 
+        hostId = par("hostId").intValue();
+        if (hostId <= 0)
+            throw cRuntimeError("hostId must be positive, 0 addresses every host");
         isPrimary = par("isPrimary").boolValue();
         partnerName = par("partnerName").stringValue();
         syncInterval = par("syncInterval").doubleValue();
         failoverTimeout = par("failoverTimeout").doubleValue();
+        heartbeatInterval = par("heartbeatInterval").doubleValue();
+        phiThreshold = par("phiThreshold").doubleValue();
+        if (phiThreshold <= 0 || phiThreshold >= PhiAccrualDetector::PHI_MAX)
+            throw cRuntimeError("phiThreshold must be in (0, %g), got %g", PhiAccrualDetector::PHI_MAX, phiThreshold);
+        double minHeartbeatStdDev = par("minHeartbeatStdDev").doubleValue();
+        if (minHeartbeatStdDev <= 0)
+            throw cRuntimeError("minHeartbeatStdDev must be positive, periodic heartbeats have no spread");
+        detector.init(par("heartbeatWindow").intValue(),
+                      minHeartbeatStdDev,
+                      par("acceptableHeartbeatPause").doubleValue());
         failureTime = par("failureTime").doubleValue();
+        recoveryTime = par("recoveryTime").doubleValue();
+        catchupChunkSize = par("catchupChunkSize").intValue();
+        failback = par("failback").boolValue();
+        if (catchupChunkSize < 1)
+            throw cRuntimeError("catchupChunkSize must be positive, got %d", catchupChunkSize);
+        loadBalancing = par("loadBalancing").boolValue();
+        primaryBuckets = par("primaryBuckets").intValue();
+        for (const string& cls : cStringTokenizer(par("rapidCommitClasses").stringValue()).asVector()) {
+            if (cls == "vip") rapidCommitPool[POOL_VIP] = true;
+            else if (cls == "pc") rapidCommitPool[POOL_PC] = true;
+            else if (cls == "mobile") rapidCommitPool[POOL_MOBILE] = true;
+            else if (cls == "printer") rapidCommitPool[POOL_PRINTER] = true;
+            else throw cRuntimeError("Unknown class \"%s\" in rapidCommitClasses", cls.c_str());
+        }
+        if (primaryBuckets < 0 || primaryBuckets > 256)
+            throw cRuntimeError("primaryBuckets must be in 0..256, got %d", primaryBuckets);
+        linkBase = Ip6Prefix::parse(par("linkBase").stringValue());
+        numLinks = par("numLinks").intValue();
+        if (numLinks < 0 || linkBase.length > 62 || (uint64_t)numLinks >= (1ULL << (62 - linkBase.length)))
+            throw cRuntimeError("numLinks %d does not fit into linkBase %s", numLinks, linkBase.str().c_str());
+        int clusterSize = par("clusterSize").intValue();
+        clustered = clusterSize > 0;
+        if (clustered) {
+            int baseId = par("clusterBaseId").intValue();
+            int shards = par("clusterShards").intValue();
+            int vnodes = par("clusterVnodes").intValue();
+            int replicas = par("clusterReplicas").intValue();
+            if (loadBalancing)
+                throw cRuntimeError("clusterSize and loadBalancing exclude each other");
+            if (hostId < baseId || hostId >= baseId + clusterSize)
+                throw cRuntimeError("hostId %d is outside the cluster's %d..%d", hostId, baseId, baseId + clusterSize - 1);
+            if (shards < 1 || vnodes < 1 || replicas < 0)
+                throw cRuntimeError("clusterShards and clusterVnodes must be positive, clusterReplicas not negative");
+            if (gateSize("peerOut") != clusterSize - 1 || gateSize("peerIn") != clusterSize - 1)
+                throw cRuntimeError("A cluster of %d needs %d peerOut and peerIn gates", clusterSize, clusterSize - 1);
+            vector<int> members;
+            for (int i = 0; i < clusterSize; i++)
+                members.push_back(baseId + i);
+            ring.init(members, vnodes, shards, replicas);
+            self = hostId - baseId;
+            peers.assign(clusterSize, Peer());
+            shardReadyAt.assign(shards, SIMTIME_ZERO);
+            joinTime = par("joinTime").doubleValue();
+        }
+        initPools();
+        syncJournalLimit = par("syncJournalLimit").intValue();
+        TraceRing::instance().attach();
+        profile.init();
 
-        nextIdForPool[pcPrefix]      = 1;
-        nextIdForPool[mobilePrefix]  = 1;
-        nextIdForPool[printerPrefix] = 1;
-        nextIdForPool[vipPrefix]     = 1;
+        string scheduling = par("queueScheduling").stdstringValue();
+        string admission = par("queueAdmission").stdstringValue();
+        if (scheduling != "strict" && scheduling != "weighted")
+            throw cRuntimeError("queueScheduling must be \"strict\" or \"weighted\", got \"%s\"", scheduling.c_str());
+        if (admission != "droptail" && admission != "pushout")
+            throw cRuntimeError("queueAdmission must be \"droptail\" or \"pushout\", got \"%s\"", admission.c_str());
+        serviceQueue.init(NUM_QCLASSES, par("queueCapacity").intValue(),
+                scheduling == "weighted" ? ServiceQueue<Pending>::WEIGHTED : ServiceQueue<Pending>::STRICT,
+                admission == "pushout" ? ServiceQueue<Pending>::PUSH_OUT : ServiceQueue<Pending>::DROP_TAIL,
+                cStringTokenizer(par("classWeights").stringValue()).asIntVector());
+        serviceTime = par("serviceTime").doubleValue();
+        frameOverhead = par("frameOverhead").doubleValue();
+        int numWorkers = par("serviceWorkers").intValue();
+        for (int i = 0; i < numWorkers; i++)
+            workers.push_back(new cMessage("serviceDone", i));
+        inService.resize(numWorkers);
+
+        for (int c = 0; c < NUM_QCLASSES; c++) {
+            queueLengthSignal[c] = registerSignal((string(qclassName(c)) + "QueueLength").c_str());
+            queueWaitSignal[c] = registerSignal((string(qclassName(c)) + "QueueWait").c_str());
+        }
+        queueDropSignal = registerSignal("queueDrop");
 
-        isActive = isPrimary;
+        advertiseDelaySignal = registerSignal("advertiseDelay");
+        replyDelaySignal = registerSignal("replyDelay");
+        failoverGapSignal = registerSignal("failoverGap");
+        detectionTimeSignal = registerSignal("detectionTime");
+        syncSizeSignal = registerSignal("syncSize");
+        leaseCountSignal = registerSignal("leaseCount");
+        catchupDurationSignal = registerSignal("catchupDuration");
+        catchupLeasesSignal = registerSignal("catchupLeases");
+        failbackTimeSignal = registerSignal("failbackTime");
+        leaseConflictSignal = registerSignal("leaseConflict");
+        shardsMovedSignal = registerSignal("shardsMoved");
+        emit(leaseCountSignal, 0L);
+
+        isActive = isPrimary || loadBalancing || clustered;
         lastPartnerHeartbeat = simTime();
 
         syncTimer = new cMessage("syncTimer");
         heartbeatTimer = new cMessage("heartbeatTimer");
-        checkPartnerTimer = new cMessage("checkPartnerTimer");
+        suspectTimer = new cMessage("suspectTimer");
+        expiryTimer = new cMessage("expiryTimer");
 
-        scheduleAt(simTime() + syncInterval, syncTimer);
-        scheduleAt(simTime() + 0.25, heartbeatTimer);
-        scheduleAt(simTime() + failoverTimeout, checkPartnerTimer);
+        string storeDir = par("leaseStoreDir").stdstringValue();
+        if (!storeDir.empty()) {
+            string base = storeDir + "/" + getFullPath();
+            if (!store.open(base))
+                throw cRuntimeError("Cannot open lease store %s.journal", base.c_str());
+            leaseSnapshotInterval = par("leaseSnapshotInterval").doubleValue();
+            snapshotTimer = new cMessage("snapshotTimer");
+            scheduleAt(simTime() + leaseSnapshotInterval, snapshotTimer);
+            loadStore(true);  // leases left by the previous run
+        }
+
+        if (clustered && joinTime > 0) {
+            // Down until then; the members drop it from the ring meanwhile
+            hasFailed = true;
+            isActive = false;
+            recoveryEvent = new cMessage("recoveryEvent");
+            scheduleAt(simTime() + joinTime, recoveryEvent);
+        }
+        else {
+            scheduleAt(simTime() + syncInterval, syncTimer);
+            scheduleAt(simTime() + heartbeatInterval, heartbeatTimer);
+            armSuspectTimer();
+        }
 
         if (failureTime > 0) {
             failureEvent = new cMessage("failureEvent");
             scheduleAt(simTime() + failureTime, failureEvent);
         }
 
-        EV << "INFO: " << getFullName() << " initialized as "
-           << (isPrimary ? "PRIMARY" : "BACKUP")
-           << " server (active=" << isActive << ")\n";
-        EV << "INFO:   Pools: pc=" << pcPrefix
-           << ", mobile=" << mobilePrefix
-           << ", printer=" << printerPrefix
-           << ", VIP=" << vipPrefix << "\n";
+        if (clustered) {
+            DLOG_INFO << "INFO: " << getFullName() << " initialized as cluster member "
+                      << self + 1 << " of " << ring.size() << " (" << ownedShards()
+                      << " of " << ring.numShards() << " shards, " << ring.numCopies() << " copies each)\n";
+        }
+        else {
+            DLOG_INFO << "INFO: " << getFullName() << " initialized as "
+                      << (isPrimary ? "PRIMARY" : "BACKUP")
+                      << " server (active=" << isActive
+                      << (loadBalancing ? ", load balancing" : "") << ")\n";
+        }
+        DLOG_INFO << "INFO:   Pools: pc=" << pools[POOL_PC].getPrefix()
+                  << ", mobile=" << pools[POOL_MOBILE].getPrefix()
+                  << ", printer=" << pools[POOL_PRINTER].getPrefix()
+                  << ", VIP=" << pools[POOL_VIP].getPrefix() << "\n";
+        if (numLinks > 0) {
+            DLOG_INFO << "INFO:   Relayed links: " << numLinks << " in " << linkBase << "\n";
+        }
+        checkpointTimer = Checkpoint::instance().attach(this, this);
+    }
+
+    // Empty pools, as at start-up and after a recovery
+    void initPools() {
+        uint64_t poolCapacity = par("poolCapacity").intValue();
+        pools.assign((numLinks + 1) * NUM_POOLS, AddressPool());
+        pools[POOL_PC].init(Ip6Prefix::parse(par("pcPrefix").stringValue()), poolCapacity);
+        pools[POOL_MOBILE].init(Ip6Prefix::parse(par("mobilePrefix").stringValue()), poolCapacity);
+        pools[POOL_PRINTER].init(Ip6Prefix::parse(par("printerPrefix").stringValue()), poolCapacity);
+        pools[POOL_VIP].init(Ip6Prefix::parse(par("vipPrefix").stringValue()), poolCapacity);
+        for (int link = 1; link <= numLinks; link++) {
+            Ip6Prefix net = linkBase.subnet(62, link);
+            for (int c = 0; c < NUM_POOLS; c++)
+                pools[link * NUM_POOLS + c].init(net.subnet(64, c), poolCapacity);
+        }
+        linkPoolMoved.assign(pools.size(), false);
+        movedLinkPools.clear();
+
+        // Partners split every pool in half, cluster members into one slice
+        // each, so they never issue the same address
+        if (loadBalancing) {
+            for (size_t i = 0; i < pools.size(); i++) {
+                uint64_t half = pools[i].getCapacity() / 2;
+                if (isPrimary)
+                    pools[i].setWindow(1, half);
+                else
+                    pools[i].setWindow(half + 1, pools[i].getCapacity());
+            }
+        }
+        else if (clustered) {
+            for (size_t i = 0; i < pools.size(); i++) {
+                uint64_t slice = pools[i].getCapacity() / ring.size();
+                pools[i].setWindow(self * slice + 1, (self + 1) * slice);
+            }
+        }
     }
 
     virtual void handleMessage(cMessage *msg) override {
+        DHCP_PROFILE_EVENT(profile, msg);
+        if (msg == checkpointTimer) {
+            Checkpoint::instance().take();
+            return;
+        }
+
         if (msg == syncTimer) {
-            if (!hasFailed) sendSync();
+            if (!hasFailed) {
+                // Commit locally first: the partner never holds a change this server could lose
+                if (store.isOpen()) store.flush(journalSeq, peerAppliedSeq, simTime().raw());
+                if (clustered) sendClusterSyncs();
+                else sendSync();
+            }
             scheduleAt(simTime() + syncInterval, syncTimer);
             return;
         }
 
+        if (msg == snapshotTimer) {
+            compactStore();
+            scheduleAt(simTime() + leaseSnapshotInterval, snapshotTimer);
+            return;
+        }
+
+        if (msg == heartbeatTimer && clustered) {
+            if (!hasFailed) clusterTick();
+            scheduleAt(simTime() + heartbeatInterval, heartbeatTimer);
+            return;
+        }
+
         if (msg == heartbeatTimer) {
-            if (!hasFailed) sendHeartbeat();
-            scheduleAt(simTime() + 0.25, heartbeatTimer);
+            // Skipped while SYNCs keep the partner informed anyway
+            simtime_t due = lastSentToPartner + heartbeatInterval;
+            if (due > simTime()) {
+                heartbeatsSuppressed++;
+                scheduleAt(due, heartbeatTimer);
+            }
+            else {
+                if (!hasFailed) sendHeartbeat();
+                scheduleAt(simTime() + heartbeatInterval, heartbeatTimer);
+            }
+            return;
+        }
+
+        if (msg == suspectTimer) {
+            partnerSuspected();
             return;
         }
 
-        if (msg == checkPartnerTimer) {
-            checkPartnerStatus();
-            scheduleAt(simTime() + failoverTimeout, checkPartnerTimer);
+        if (msg == expiryTimer) {
+            expireDue();
             return;
         }
 
@@ -137,234 +682,1927 @@ class DHCP : public cSimpleModule {
             return;
         }
 
-        if (hasFailed) {
-            delete msg;
+        if (msg == recoveryEvent) {
+            recover();
             return;
         }
 
-        if (msg->getKind() == DHCP_HEARTBEAT) {
-            lastPartnerHeartbeat = simTime();
-            if (!partnerAlive) {
-                partnerAlive = true;
-            }
+        if (msg->isSelfMessage() && msg->getKind() < (short)workers.size()
+                && workers[msg->getKind()] == msg) {
+            completeService(msg->getKind());
+            return;
+        }
+
+        if (hasFailed) {
             delete msg;
             return;
         }
 
-        if (msg->getKind() == DHCP_SYNC) {
-            receiveSync(msg);
+        DHCP_TRACE_MSG(this, msg);
+
+        if (auto *peer = dynamic_cast<DhcpPeerMessage *>(msg)) {
+            handlePeerMessage(peer);
             delete msg;
             return;
         }
 
         if (msg->arrivedOn("ppp$i")) {
-            handleDHCPMessage(msg);
+            if (auto *fwd = dynamic_cast<DhcpRelayForward *>(msg)) {
+                receiveRelayForward(fwd);
+                delete msg;
+            }
+            else if (workers.empty())
+                handleDHCPMessage(msg);
+            else
+                enqueueClientMessage(msg, Origin(), serviceTime + frameOverhead);
         } else {
             delete msg;
         }
     }
 
-    void handleDHCPMessage(cMessage *msg) {
-        long dst = DST(msg);
-        if (dst != 0 && dst != getId()) {
+    // Client messages of a relayed link, served like direct ones but from
+    // the link's pools and answered through the relay. The frame overhead
+    // is charged to the first message only.
+    void receiveRelayForward(DhcpRelayForward *fwd) {
+        if (DST(fwd) != hostId) return;  // flooded while the switches learn
+        Origin from;
+        from.relayId = SRC(fwd);
+        from.linkAddress = fwd->getLinkAddress();
+        from.link = linkOf(from.linkAddress);
+        if (from.link < 0) {
+            DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                      << " RELAY-FORW from unknown link " << from.linkAddress << "\n";
+            return;
+        }
+        relayFramesReceived++;
+        for (size_t i = 0; i < fwd->getMessagesArraySize(); i++) {
+            DhcpMessage *inner = fwd->removeMessages(i);
+            if (!inner) continue;
+            relayedReceived++;
+            from.peerAddress = i < fwd->getPeerAddressesArraySize() ? fwd->getPeerAddresses(i) : Ip6Address();
+            if (workers.empty()) {
+                origin = from;
+                handleDHCPMessage(inner);
+                origin = Origin();
+            }
+            else {
+                enqueueClientMessage(inner, from, serviceTime + (i == 0 ? frameOverhead : SIMTIME_ZERO));
+            }
+        }
+    }
+
+    // Sends an answer to a client, wrapped for the relay it came through
+    void respond(DhcpMessage *msg, simtime_t delay) {
+        if (origin.relayId == 0) {
+            sendDelayed(msg, delay, "ppp$o");
+            return;
+        }
+        auto *rr = mk<DhcpRelayReply>("DHCPV6_RELAY_REPL", DHCPV6_RELAY_REPL, hostId, origin.relayId);
+        rr->setLinkAddress(origin.linkAddress);
+        rr->appendMessages(msg);
+        rr->appendPeerAddresses(origin.peerAddress);
+        sendDelayed(rr, delay, "ppp$o");
+        relayRepliesSent++;
+    }
+
+    static const char *qclassName(int cls) {
+        static const char *names[NUM_QCLASSES] = { "vip", "pc", "mobile", "printer" };
+        return names[cls];
+    }
+
+    // Queue class of a client message: the pool it is asking about
+    int queueClassOf(cMessage *msg) const {
+        int pool = -1;
+        if (auto *sol = dynamic_cast<DhcpSolicit *>(msg))
+            pool = pickPool(sol->getDeviceClass(), sol->getPriority());
+        else if (auto *req = dynamic_cast<DhcpRequest *>(msg))
+            pool = poolOf(req->getAddress());
+        else if (auto *ren = dynamic_cast<DhcpRenew *>(msg))
+            pool = poolOf(ren->getAddress());
+        else if (auto *rel = dynamic_cast<DhcpRelease *>(msg))
+            pool = poolOf(rel->getAddress());
+        else if (auto *dec = dynamic_cast<DhcpDecline *>(msg))
+            pool = poolOf(dec->getAddress());
+        switch (pool < 0 ? -1 : pool % NUM_POOLS) {
+            case POOL_VIP:     return QCLASS_VIP;
+            case POOL_MOBILE:  return QCLASS_MOBILE;
+            case POOL_PRINTER: return QCLASS_PRINTER;
+            default:           return QCLASS_PC;
+        }
+    }
+
+    void enqueueClientMessage(cMessage *msg, const Origin& from, simtime_t cost) {
+        if (!shouldServe(check_and_cast<DhcpMessage *>(msg))) {
             delete msg;
             return;
         }
 
-        if (!isActive) {
+        Pending p;
+        p.msg = msg;
+        p.arrival = simTime();
+        p.cls = queueClassOf(msg);
+        p.origin = from;
+        p.cost = cost;
+        Pending evicted;
+        int evictedClass;
+        switch (serviceQueue.push(p.cls, p, evicted, evictedClass)) {
+            case ServiceQueue<Pending>::DROPPED:
+                dropQueued(p);
+                return;
+            case ServiceQueue<Pending>::ADMITTED_EVICTED:
+                dropQueued(evicted);
+                break;
+            default:
+                break;
+        }
+        emit(queueLengthSignal[p.cls], (long)serviceQueue.size(p.cls));
+        dispatch();
+    }
+
+    void dropQueued(const Pending& p) {
+        queueDrops[p.cls]++;
+        emit(queueDropSignal, (long)p.cls);
+        emit(queueLengthSignal[p.cls], (long)serviceQueue.size(p.cls));
+        DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                  << " queue full, dropped " << p.msg->getName()
+                  << " (" << qclassName(p.cls) << ")\n";
+        delete p.msg;
+    }
+
+    // Hands queued messages to idle workers
+    void dispatch() {
+        for (size_t w = 0; w < workers.size() && serviceQueue.size() > 0; w++) {
+            if (workers[w]->isScheduled()) continue;
+            Pending& p = inService[w];
+            int cls;
+            serviceQueue.pop(p, cls);
+            emit(queueLengthSignal[cls], (long)serviceQueue.size(cls));
+            emit(queueWaitSignal[cls], simTime() - p.arrival);
+            scheduleAt(simTime() + p.cost, workers[w]);
+        }
+    }
+
+    void completeService(int w) {
+        Pending p = inService[w];
+        inService[w].msg = nullptr;
+        queueServed[p.cls]++;
+        queueingDelay = simTime() - p.arrival;
+        origin = p.origin;
+        handleDHCPMessage(p.msg);
+        origin = Origin();
+        queueingDelay = SIMTIME_ZERO;
+        dispatch();
+    }
+
+    // Drops everything waiting or in service, e.g. when the server fails
+    void flushServiceQueue() {
+        serviceQueue.clear([](Pending& p) { delete p.msg; });
+        for (size_t w = 0; w < workers.size(); w++) {
+            if (workers[w]->isScheduled())
+                cancelEvent(workers[w]);
+            delete inService[w].msg;
+            inService[w].msg = nullptr;
+        }
+    }
+
+    // A message sent to this server by id is always answered while active.
+    // Multicast ones are left to the partner if it owns the client's bucket.
+    // In a cluster only the owner of the client's shard answers; a client
+    // still talking to a former owner gets through once it rebinds.
+    bool shouldServe(const DhcpMessage *msg) const {
+        int dst = DST(msg);
+        if (dst != 0 && dst != hostId) return false;
+        if (!isActive) return false;
+        if (clustered) return servesShard(ring.shardOf(SRC(msg)));
+        return dst != 0 || servesClient(SRC(msg));
+    }
+
+    bool ownsBucket(int clientId) const {
+        bool primaryBucket = loadBalanceBucket(clientId) < primaryBuckets;
+        return primaryBucket == isPrimary;
+    }
+
+    // With the partner down the survivor takes over its buckets
+    bool servesClient(int clientId) const {
+        return !loadBalancing || !partnerAlive || ownsBucket(clientId);
+    }
+
+    void handleDHCPMessage(cMessage *msg) {
+        auto *dmsg = check_and_cast<DhcpMessage *>(msg);
+        if (!shouldServe(dmsg)) {
             delete msg;
             return;
         }
 
         if (msg->getKind() == DHCPV6_SOLICIT) {
+            auto *sol = check_and_cast<DhcpSolicit *>(msg);
             solicitsReceived++;
-            long dev = SRC(msg);
-            string devType = (msg->hasPar("type") ? msg->par("type").stringValue() : "pc");
-            int prio = (msg->hasPar("priority") ? (int)msg->par("priority").longValue() : 1);
-
-            bool isVip = isVipClient(devType, prio);
-            string prefix = pickPrefix(devType, prio);
-            string offer  = makeAddress(prefix, nextIdForPool[prefix]);
-
-            nextIdForPool[prefix]++;
-
-            EV << "INFO: [" << simTime() << "] " << getFullName()
-               << " SOLICIT from devId=" << dev
-               << " type=" << devType << " prio=" << prio
-               << " -> ADVERTISE " << offer
-               << (isVip ? " (VIP)" : " (normal)") << "\n";
-
-            auto *adv = mk("DHCPV6_ADVERTISE", DHCPV6_ADVERTISE, getId(), dev);
-            adv->addPar("ip6").setStringValue(offer.c_str());
-            adv->addPar("serverName").setStringValue(getFullName());
-            adv->addPar("serverId").setLongValue(getId());
+            int dev = SRC(sol);
+            int devClass = sol->getDeviceClass();
+            int prio = sol->getPriority();
+
+            bool isVip = isVipClient(devClass, prio);
+            int pool = origin.link * NUM_POOLS + pickPool(devClass, prio);
+            Ip6Address offer;
+            if (!makeOffer(dev, pool, offer)) {
+                DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                          << " pool exhausted, ignoring SOLICIT from devId=" << dev << "\n";
+                delete msg;
+                return;
+            }
+
+            // Rapid Commit: bind now and skip ADVERTISE/REQUEST
+            if (sol->getRapidCommit() && rapidCommitPool[pool % NUM_POOLS]) {
+                offers.erase(dev);  // its wheel entry goes stale and is skipped
+                setLease(dev, offer, simTime() + validLifetime);
+                rapidCommits++;
+
+                DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                          << " SOLICIT from devId=" << dev
+                          << " type=" << deviceClassName(devClass) << " prio=" << prio
+                          << " -> rapid commit REPLY " << offer
+                          << (isVip ? " (VIP)" : " (normal)") << "\n";
+
+                sendReply(dev, offer, true, isVip, true);
+                delete msg;
+                return;
+            }
+
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " SOLICIT from devId=" << dev
+                      << " type=" << deviceClassName(devClass) << " prio=" << prio
+                      << " -> ADVERTISE " << offer
+                      << (isVip ? " (VIP)" : " (normal)") << "\n";
+
+            auto *adv = mk<DhcpAdvertise>("DHCPV6_ADVERTISE", DHCPV6_ADVERTISE, hostId, dev);
+            adv->setAddress(offer);
+            adv->setServerId(hostId);
             simtime_t d = isVip ? fastResponseDelay : normalResponseDelay;
-            sendDelayed(adv, d, "ppp$o");
+            respond(adv, d);
             advertiseSent++;
+            emit(advertiseDelaySignal, queueingDelay + d);
         }
         else if (msg->getKind() == DHCPV6_REQUEST) {
+            auto *req = check_and_cast<DhcpRequest *>(msg);
             requestsReceived++;
-            long dev = SRC(msg);
-            string ip6 = msg->par("ip6").stringValue();
-            int prio = (msg->hasPar("priority") ? (int)msg->par("priority").longValue() : 1);
+            int dev = SRC(req);
+            const Ip6Address& ip6 = req->getAddress();
+            int prio = req->getPriority();
+            bool isVip = isVipPool(poolOf(ip6));
 
-            addrTable[dev] = ip6;
+            int holder = addrIndex.find(ip6);
+            if (holder != LeaseIndex::NONE && holder != dev) {
+                // Offered by the partner too, e.g. around a failover: the
+                // client starts over with a SOLICIT
+                requestConflicts++;
+                emit(leaseConflictSignal, 0L);
+                DHCP_TRACE_EVENT(this, TRACE_LEASE_CONFLICT, ip6);
+                DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                          << " REQUEST from devId=" << dev << " for " << ip6
+                          << " held by devId=" << holder << " -> REPLY without binding\n";
+                sendReply(dev, ip6, false, isVip);
+                delete msg;
+                return;
+            }
 
-            string key = poolKeyFrom(ip6);
-            bool isVip = (key.find("vip::") != string::npos || key == vipPrefix);
+            auto offered = offers.find(dev);
+            if (offered != offers.end() && offered->second.address == ip6) {
+                offers.erase(offered);
+            }
+            else {
+                // Not offered by us (e.g. before a failover): bound only if
+                // it is from our pools and free, or already this client's.
+                // A taken id nobody holds is on offer to another client.
+                int pool = poolOf(ip6);
+                if (pool < 0 || (holder != dev && !pools[pool].reserve(ip6))) {
+                    requestConflicts++;
+                    emit(leaseConflictSignal, 0L);
+                    DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                              << " REQUEST from devId=" << dev << " for " << ip6
+                              << (pool < 0 ? " outside every pool" : " offered to another client")
+                              << " -> REPLY without binding\n";
+                    sendReply(dev, ip6, false, isVip);
+                    delete msg;
+                    return;
+                }
+            }
+            setLease(dev, ip6, simTime() + validLifetime);
 
-            EV << "INFO: [" << simTime() << "] " << getFullName()
-               << " REQUEST from devId=" << dev
-               << " prio=" << prio << " for " << ip6
-               << " -> REPLY " << (isVip ? "(VIP)" : "(normal)") << "\n";
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " REQUEST from devId=" << dev
+                      << " prio=" << prio << " for " << ip6
+                      << " -> REPLY " << (isVip ? "(VIP)" : "(normal)") << "\n";
 
-            auto *rep = mk("DHCPV6_REPLY", DHCPV6_REPLY, getId(), dev);
-            rep->addPar("ip6").setStringValue(ip6.c_str());
-            rep->addPar("serverName").setStringValue(getFullName());
-            simtime_t d = isVip ? fastResponseDelay : normalResponseDelay;
-            sendDelayed(rep, d, "ppp$o");
-            repliesSent++;
+            sendReply(dev, ip6, true, isVip);
+        }
+        else if (msg->getKind() == DHCPV6_RENEW || msg->getKind() == DHCPV6_REBIND) {
+            auto *ren = check_and_cast<DhcpRenew *>(msg);
+            bool rebind = msg->getKind() == DHCPV6_REBIND;
+            if (rebind) rebindsReceived++;
+            else renewsReceived++;
+            int dev = SRC(ren);
+            const Ip6Address& ip6 = ren->getAddress();
+            bool isVip = isVipPool(poolOf(ip6));
+
+            auto it = addrTable.find(dev);
+            bool bound = it != addrTable.end() && it->second.address == ip6;
+            if (bound)
+                setLease(dev, ip6, simTime() + validLifetime);
+
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << (rebind ? " REBIND" : " RENEW") << " from devId=" << dev
+                      << " for " << ip6 << (bound ? " -> extended" : " -> no binding") << "\n";
+
+            // A rebinding client may still reach a server that knows it
+            if (bound || !rebind)
+                sendReply(dev, ip6, bound, isVip);
+        }
+        else if (msg->getKind() == DHCPV6_RELEASE) {
+            auto *rel = check_and_cast<DhcpRelease *>(msg);
+            releasesReceived++;
+            int dev = SRC(rel);
+            auto it = addrTable.find(dev);
+            if (it != addrTable.end() && it->second.address == rel->getAddress())
+                removeLease(dev, true);
+
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " RELEASE from devId=" << dev << " for " << rel->getAddress() << "\n";
+
+            sendReply(dev, rel->getAddress(), false, isVipPool(poolOf(rel->getAddress())));
+        }
+        else if (msg->getKind() == DHCPV6_DECLINE) {
+            auto *dec = check_and_cast<DhcpDecline *>(msg);
+            declinesReceived++;
+            int dev = SRC(dec);
+            const Ip6Address& ip6 = dec->getAddress();
+            auto it = addrTable.find(dev);
+            bool bound = it != addrTable.end() && it->second.address == ip6;
+            if (bound) {
+                removeLease(dev, true, false);
+                quarantine(ip6, simTime() + declineHoldTime, true);
+            }
+
+            DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                      << " DECLINE from devId=" << dev << " for " << ip6
+                      << (bound ? " -> address quarantined" : " -> no binding") << "\n";
+
+            sendReply(dev, ip6, false, isVipPool(poolOf(ip6)));
         }
         delete msg;
     }
 
+    void sendReply(int dev, const Ip6Address& ip6, bool bound, bool isVip, bool rapidCommit = false) {
+        auto *rep = mk<DhcpReply>("DHCPV6_REPLY", DHCPV6_REPLY, hostId, dev);
+        rep->setAddress(ip6);
+        rep->setServerId(hostId);
+        rep->setRapidCommit(rapidCommit);
+        if (bound) {
+            rep->setValidLifetime(validLifetime);
+            rep->setPreferredLifetime(preferredLifetime);
+        }
+        simtime_t d = isVip ? fastResponseDelay : normalResponseDelay;
+        respond(rep, d);
+        repliesSent++;
+        emit(replyDelaySignal, queueingDelay + d);
+
+        if (bound && awaitingFailoverReply && (!loadBalancing || !ownsBucket(dev))) {
+            awaitingFailoverReply = false;
+            emit(failoverGapSignal, simTime() + d - partnerLastSeen);
+        }
+    }
+
+    void leaseTableChanged() {
+        if (addrTable.size() == lastLeaseCount) return;
+        lastLeaseCount = addrTable.size();
+        emit(leaseCountSignal, (long)lastLeaseCount);
+    }
+
+    // The caller makes sure no other client holds addr
+    void setLease(int clientId, const Ip6Address& addr, simtime_t validUntil) {
+        auto it = addrTable.find(clientId);
+        if (it != addrTable.end() && it->second.address != addr) {
+            releaseAddress(it->second.address);
+            addrIndex.erase(it->second.address, clientId);
+        }
+        addrIndex.set(addr, clientId);
+        Lease& lease = addrTable[clientId];
+        lease.address = addr;
+        lease.validUntil = validUntil;
+        lease.peer = false;
+        trackExpiry(clientId, lease);
+        recordChange(clientId, addr, validUntil);
+        persist(clientId, addr, validUntil, false);
+        leaseTableChanged();
+    }
+
+    // Drops a binding and returns its address to the pool, unless it was
+    // declined. Only the active server replicates removals of its own
+    // leases; expiring a lease it has only mirrored must not erase the
+    // partner's fresher copy.
+    void removeLease(int clientId, bool replicate, bool reuseAddress = true) {
+        auto it = addrTable.find(clientId);
+        if (it == addrTable.end()) return;
+        if (reuseAddress)
+            releaseAddress(it->second.address);
+        addrIndex.erase(it->second.address, clientId);
+        addrTable.erase(it);
+        if (replicate)
+            recordChange(clientId, Ip6Address(), SIMTIME_ZERO);
+        persist(clientId, Ip6Address(), SIMTIME_ZERO, false);
+        leaseTableChanged();
+    }
+
+    // Keeps a declined address out of use until the given time. The entry
+    // sits in the lease table under a negative key derived from the
+    // address, so replication, the lease store, snapshots and the expiry
+    // wheel carry it like a lease; when it expires the address goes back
+    // to its pool. Each server lifts its own copy, so only the start of a
+    // quarantine is replicated.
+    void quarantine(const Ip6Address& addr, simtime_t until, bool replicate) {
+        int holder = addrIndex.find(addr);
+        if (holder != LeaseIndex::NONE) {
+            Lease& held = addrTable.at(holder);
+            if (held.declined && held.validUntil >= until) return;
+            if (!held.declined)
+                removeLease(holder, false, false);  // the partner's client declined it
+        }
+        else {
+            int pool = poolOf(addr);
+            if (pool >= 0 && !pools[pool].reserve(addr))
+                withdrawOffer(addr);  // the quarantine keeps the id
+        }
+        int key = holder != LeaseIndex::NONE && holder < 0 ? holder : declinedKey(addr);
+        while (addrTable.count(key) && addrTable[key].address != addr)
+            key = key > INT_MIN ? key - 1 : QUARANTINE_KEY_FIRST;  // another address hashed here
+        addrIndex.set(addr, key);
+        Lease& lease = addrTable[key];
+        lease.address = addr;
+        lease.validUntil = until;
+        lease.peer = false;
+        lease.declined = true;
+        trackExpiry(key, lease);
+        if (replicate)
+            recordChange(key, addr, until, true);
+        if (store.isOpen())
+            store.append(LeaseStore::KIND_DECLINED, key, addr.hi, addr.lo, until.raw());
+        leaseTableChanged();
+    }
+
+    // Client ids are positive and -1 is LeaseIndex::NONE; quarantine
+    // entries start at -2 and hash to the same key on every server unless
+    // two declined addresses collide
+    static const int QUARANTINE_KEY_FIRST = -2;
+    static_assert(QUARANTINE_KEY_FIRST < (int)LeaseIndex::NONE, "quarantine keys must not meet the empty-slot marker");
+    static int declinedKey(const Ip6Address& a) {
+        uint64_t h = a.hi * 0x9e3779b97f4a7c15ULL ^ a.lo;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return QUARANTINE_KEY_FIRST - (int)(h & 0x3fffffff);
+    }
+
+    void persist(int clientId, const Ip6Address& addr, simtime_t validUntil, bool peer) {
+        if (store.isOpen())
+            store.append(peer ? LeaseStore::KIND_PEER : LeaseStore::KIND_OWN,
+                         clientId, addr.hi, addr.lo, validUntil.raw());
+    }
+
+    void recordChange(int clientId, const Ip6Address& addr, simtime_t validUntil, bool declined = false) {
+        journal.push_back({++journalSeq, clientId, addr, validUntil, declined});
+        // A partner this far behind gets a full snapshot instead
+        if ((int)journal.size() > syncJournalLimit)
+            journal.pop_front();
+    }
+
+    int64_t tickOf(simtime_t t) const {
+        return (int64_t)std::ceil(t.dbl() / expiryGranularity);
+    }
+
+    void trackExpiry(int clientId, Lease& lease) {
+        lease.expiryTick = expiryWheel.insert(clientId, EXPIRE_LEASE, tickOf(lease.validUntil));
+        armExpiryTimer();
+    }
+
+    void armExpiryTimer() {
+        int64_t deadline = expiryWheel.nextDeadline();
+        if (deadline < 0) {
+            cancelEvent(expiryTimer);
+            return;
+        }
+        simtime_t t = deadline * expiryGranularity;
+        if (t < simTime()) t = simTime();
+        if (!expiryTimer->isScheduled() || expiryTimer->getArrivalTime() > t)
+            rescheduleAt(t, expiryTimer);
+    }
+
+    // Entries are checked against the lease they point at: a renewal or
+    // rebinding re-inserts the client and leaves the old entry stale.
+    void expireDue() {
+        int64_t nowTick = (int64_t)std::floor(simTime().dbl() / expiryGranularity + 1e-9);
+        dueEntries.clear();
+        expiryWheel.advance(nowTick, dueEntries);
+
+        for (const TimingWheel::Entry& e : dueEntries) {
+            if (e.tag == EXPIRE_OFFER) {
+                auto it = offers.find(e.key);
+                if (it == offers.end() || it->second.expiryTick != e.tick) continue;
+                releaseAddress(it->second.address);
+                offers.erase(it);
+                offersExpired++;
+                continue;
+            }
+            auto it = addrTable.find(e.key);
+            if (it == addrTable.end() || it->second.expiryTick != e.tick) continue;
+            if (it->second.validUntil > simTime()) {
+                trackExpiry(e.key, it->second);  // was clamped to the wheel horizon
+                continue;
+            }
+            if (it->second.declined) {
+                DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                          << " quarantine of declined " << it->second.address << " lifted\n";
+                removeLease(e.key, false);  // the partner lifts its own copy
+                quarantinesLifted++;
+                continue;
+            }
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " lease of devId=" << e.key << " on " << it->second.address << " expired\n";
+            DHCP_TRACE_EVENT(this, TRACE_LEASE_EXPIRED, it->second.address);
+            removeLease(e.key, isActive && !it->second.peer);
+            leasesExpired++;
+        }
+        armExpiryTimer();
+    }
+
+    void handlePeerMessage(DhcpPeerMessage *msg) {
+        if (clustered) {
+            handleClusterMessage(msg);
+            return;
+        }
+        partnerHeard(msg);
+        switch (msg->getKind()) {
+            case DHCP_SYNC:
+                // Deltas sent meanwhile are replayed from the catch-up snapshot on
+                if (catchingUp) handlePeerAck(msg);
+                else receiveSync(check_and_cast<DhcpSync *>(msg));
+                break;
+            case DHCP_CATCHUP_REQUEST:
+                sendCatchupChunk(check_and_cast<DhcpCatchupRequest *>(msg));
+                break;
+            case DHCP_CATCHUP_CHUNK:
+                receiveCatchupChunk(check_and_cast<DhcpCatchupChunk *>(msg));
+                break;
+            case DHCP_FAILBACK_REQUEST:
+                handlePeerAck(msg);
+                handOverActive();
+                break;
+            case DHCP_FAILBACK_ACK:
+                handlePeerAck(msg);
+                if (failbackPending) {
+                    failbackAcked = true;
+                    failbackSeq = check_and_cast<DhcpFailbackAck *>(msg)->getLastSeq();
+                    completeFailback();
+                }
+                break;
+            default:
+                handlePeerAck(msg);
+                break;
+        }
+    }
+
+    // Fills in the header every peer message carries
+    void sendToPartner(DhcpPeerMessage *msg) {
+        if (!gate("syncOut")->isConnected()) {
+            delete msg;
+            return;
+        }
+        msg->setServerId(hostId);
+        msg->setAckSeq(peerAppliedSeq);
+        msg->setResyncRequest(resyncNeeded);
+        msg->setIsActive(isActive);
+        lastSentToPartner = simTime();
+        send(msg, "syncOut");
+    }
+
     void sendSync() {
         if (!gate("syncOut")->isConnected()) return;
 
-        auto *sync = new cMessage("DHCP_SYNC", DHCP_SYNC);
-        sync->addPar("pcNext").setLongValue(nextIdForPool[pcPrefix]);
-        sync->addPar("mobileNext").setLongValue(nextIdForPool[mobilePrefix]);
-        sync->addPar("printerNext").setLongValue(nextIdForPool[printerPrefix]);
-        sync->addPar("vipNext").setLongValue(nextIdForPool[vipPrefix]);
-        sync->addPar("isActive").setBoolValue(isActive);
+        if (journalSeq == sentSeq && !poolsDirty) {
+            syncsSkipped++;
+            return;
+        }
+
+        auto *sync = new DhcpSync("DHCP_SYNC", DHCP_SYNC);
+        sync->setPcNext(pools[POOL_PC].getNextId());
+        sync->setMobileNext(pools[POOL_MOBILE].getNextId());
+        sync->setPrinterNext(pools[POOL_PRINTER].getNextId());
+        sync->setVipNext(pools[POOL_VIP].getNextId());
+        sync->setFirstSeq(sentSeq + 1);
+        sync->setLastSeq(journalSeq);
 
-        std::stringstream leaseData;
-        for (const auto& entry : addrTable) {
-            leaseData << entry.first << ":" << entry.second << ";";
-        }
-        sync->addPar("leases").setStringValue(leaseData.str().c_str());
-
-        send(sync, "syncOut");
-    }
-
-    void receiveSync(cMessage *msg) {
-        uint64_t pcNext = msg->par("pcNext").longValue();
-        uint64_t mobNext = msg->par("mobileNext").longValue();
-        uint64_t prnNext = msg->par("printerNext").longValue();
-        uint64_t vipNext = msg->par("vipNext").longValue();
-
-        if (pcNext > nextIdForPool[pcPrefix])
-            nextIdForPool[pcPrefix] = pcNext;
-        if (mobNext > nextIdForPool[mobilePrefix])
-            nextIdForPool[mobilePrefix] = mobNext;
-        if (prnNext > nextIdForPool[printerPrefix])
-            nextIdForPool[printerPrefix] = prnNext;
-        if (vipNext > nextIdForPool[vipPrefix])
-            nextIdForPool[vipPrefix] = vipNext;
-
-        if (msg->hasPar("leases")) {
-            string leaseStr = msg->par("leases").stringValue();
-            if (!leaseStr.empty()) {
-                std::stringstream ss(leaseStr);
-                string entry;
-                while (std::getline(ss, entry, ';')) {
-                    if (entry.empty()) continue;
-                    size_t colon = entry.find(':');
-                    if (colon != string::npos) {
-                        long devId = std::stol(entry.substr(0, colon));
-                        string addr = entry.substr(colon + 1);
-                        addrTable[devId] = addr;
-                    }
-                }
+        // Changes the partner still needs may already be trimmed
+        bool full = journalSeq > sentSeq &&
+                    (journal.empty() || journal.front().seq > sentSeq + 1);
+        sync->setFullSnapshot(full);
+
+        if (full) {
+            size_t own = 0;
+            for (const auto& entry : addrTable)
+                if (!entry.second.peer) own++;
+            sync->setLeasesArraySize(own);
+            size_t i = 0;
+            for (const auto& entry : addrTable) {
+                if (entry.second.peer) continue;
+                LeaseRecord& rec = sync->getLeasesForUpdate(i++);
+                rec.clientId = entry.first;
+                rec.address = entry.second.address;
+                rec.validUntil = entry.second.validUntil;
+                rec.declined = entry.second.declined;
+            }
+            snapshotsSent++;
+        }
+        else if (journalSeq > sentSeq) {
+            size_t start = sentSeq + 1 - journal.front().seq;
+            sync->setLeasesArraySize(journal.size() - start);
+            for (size_t i = start; i < journal.size(); i++) {
+                LeaseRecord& rec = sync->getLeasesForUpdate(i - start);
+                rec.clientId = journal[i].clientId;
+                rec.address = journal[i].address;
+                rec.validUntil = journal[i].validUntil;
+                rec.declined = journal[i].declined;
             }
         }
+
+        setLinkCursors(sync, full);
+        leaseRecordsSent += sync->getLeasesArraySize();
+        emit(syncSizeSignal, (long)(SYNC_HEADER_BYTES + LEASE_RECORD_BYTES * sync->getLeasesArraySize()));
+        syncsSent++;
+        sentSeq = journalSeq;
+        poolsDirty = false;
+        sendToPartner(sync);
+    }
+
+    void receiveSync(DhcpSync *msg) {
+        handlePeerAck(msg);
+
+        pools[POOL_PC].advanceTo(msg->getPcNext());
+        pools[POOL_MOBILE].advanceTo(msg->getMobileNext());
+        pools[POOL_PRINTER].advanceTo(msg->getPrinterNext());
+        pools[POOL_VIP].advanceTo(msg->getVipNext());
+        applyLinkCursors(msg);
+
+        if (msg->getFullSnapshot()) {
+            // The snapshot replaces everything mirrored from the partner
+            for (auto it = addrTable.begin(); it != addrTable.end(); ) {
+                if (!it->second.peer) { ++it; continue; }
+                releaseAddress(it->second.address);
+                addrIndex.erase(it->second.address, it->first);
+                persist(it->first, Ip6Address(), SIMTIME_ZERO, true);
+                it = addrTable.erase(it);
+            }
+            for (size_t i = 0; i < msg->getLeasesArraySize(); i++) {
+                const LeaseRecord& rec = msg->getLeases(i);
+                applyPeerRecord(rec);
+            }
+            peerAppliedSeq = msg->getLastSeq();
+            resyncNeeded = false;
+            leaseTableChanged();
+            completeFailback();
+            return;
+        }
+
+        if (msg->getLeasesArraySize() == 0) return;
+
+        if (msg->getFirstSeq() > peerAppliedSeq + 1) {
+            // Missed a delta; ask the partner to resend from our ack
+            resyncNeeded = true;
+            return;
+        }
+
+        for (size_t i = 0; i < msg->getLeasesArraySize(); i++) {
+            uint64_t seq = msg->getFirstSeq() + i;
+            if (seq <= peerAppliedSeq) continue;  // already applied
+            const LeaseRecord& rec = msg->getLeases(i);
+            applyPeerRecord(rec);
+        }
+        peerAppliedSeq = msg->getLastSeq();
+        resyncNeeded = false;
+        leaseTableChanged();
+        completeFailback();
+    }
+
+    // Quarantines are matched by address: the partner's key for one may
+    // differ, and it never sends their removal
+    void applyPeerRecord(const LeaseRecord& rec) {
+        if (rec.declined)
+            quarantine(rec.address, rec.validUntil, false);
+        else if (rec.clientId > 0)
+            applyPeerLease(rec.clientId, rec.address, rec.validUntil);
+    }
+
+    // Mirrors a partner change locally, keeping the pools in step so this
+    // server never hands out an address the partner has bound.
+    void applyPeerLease(int clientId, const Ip6Address& addr, simtime_t validUntil) {
+        auto own = addrTable.find(clientId);
+        if (own != addrTable.end() && !own->second.peer && !peerRecordWins(clientId, own->second, addr, validUntil))
+            return;
+        if (!addr.isUnspecified()) {
+            int holder = addrIndex.find(addr);
+            if (holder != LeaseIndex::NONE && holder != clientId && !peerLeaseWins(holder, clientId, addr, validUntil))
+                return;
+        }
+        persist(clientId, addr, validUntil, true);
+        auto it = addrTable.find(clientId);
+        if (it != addrTable.end() && it->second.address != addr) {
+            releaseAddress(it->second.address);
+            addrIndex.erase(it->second.address, clientId);
+            addrTable.erase(it);
+            it = addrTable.end();
+        }
+        if (addr.isUnspecified()) return;
+        if (it == addrTable.end()) {
+            int pool = poolOf(addr);
+            if (pool >= 0 && !pools[pool].reserve(addr))
+                withdrawOffer(addr);  // the partner bound it first
+        }
+        addrIndex.set(addr, clientId);
+        Lease& lease = addrTable[clientId];
+        lease.address = addr;
+        lease.validUntil = validUntil;
+        lease.peer = true;
+        trackExpiry(clientId, lease);
+    }
+
+    // The partner bound addr to clientId while it is bound here to holder,
+    // as when both servers issued it around a failover. Both sides keep
+    // the binding that runs longer, i.e. the more recent one, the lower
+    // client id on a tie, so they agree without another round trip. The
+    // losing client learns on its next RENEW and starts over.
+    // A partner record for a client bound here replaces that binding only
+    // if it runs longer; a removal never does. Otherwise it is a stale
+    // journal or snapshot entry, e.g. from before a failover, and the
+    // partner is sent the local binding instead.
+    bool peerRecordWins(int clientId, const Lease& local, const Ip6Address& addr, simtime_t validUntil) {
+        if (addr == local.address && validUntil == local.validUntil) return false;
+        bool peerWins = !addr.isUnspecified() &&
+                        (validUntil > local.validUntil || (validUntil == local.validUntil && addr < local.address));
+        if (!peerWins) {
+            staleSyncRecords++;
+            DLOG_DETAIL << "INFO: [" << simTime() << "] " << getFullName()
+                        << " ignored a stale partner record for devId=" << clientId
+                        << ", keeping " << local.address << " until t=" << local.validUntil << "s\n";
+            recordChange(clientId, local.address, local.validUntil);
+        }
+        return peerWins;
+    }
+
+    bool peerLeaseWins(int holder, int clientId, const Ip6Address& addr, simtime_t validUntil) {
+        syncConflicts++;
+        emit(leaseConflictSignal, 1L);
+        DHCP_TRACE_EVENT(this, TRACE_LEASE_CONFLICT, addr);
+        Lease& local = addrTable.at(holder);
+        bool peerWins = !local.declined &&
+                        (validUntil > local.validUntil || (validUntil == local.validUntil && clientId < holder));
+        DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                  << " conflict on " << addr << ": devId=" << holder << " here, devId=" << clientId
+                  << " at the partner -> keeping devId=" << (peerWins ? clientId : holder) << "\n";
+        if (peerWins) {
+            removeLease(holder, !local.peer);
+        }
+        else if (!local.peer) {
+            // The partner may never have seen it, e.g. it came from the local store
+            recordChange(holder, addr, local.validUntil, local.declined);
+        }
+        return peerWins;
+    }
+
+    void handlePeerAck(DhcpPeerMessage *msg) {
+        uint64_t ack = msg->getAckSeq();
+        if (ack > peerAckedSeq) {
+            peerAckedSeq = ack;
+            while (!journal.empty() && journal.front().seq <= ack)
+                journal.pop_front();
+        }
+        if (msg->getResyncRequest() && ack < sentSeq)
+            sentSeq = ack;
     }
 
     void sendHeartbeat() {
         if (!gate("syncOut")->isConnected()) return;
-        auto *hb = new cMessage("DHCP_HEARTBEAT", DHCP_HEARTBEAT);
-        send(hb, "syncOut");
+        heartbeatsSent++;
+        sendToPartner(new DhcpHeartbeat("DHCP_HEARTBEAT", DHCP_HEARTBEAT));
     }
 
-    void checkPartnerStatus() {
+    // Any message from the partner counts as a heartbeat
+    void partnerHeard(const DhcpPeerMessage *msg) {
+        if (!partnerAlive) {
+            partnerAlive = true;
+            detector.reset();  // the outage is not a sample
+        }
+        partnerActive = msg->getIsActive();
+        lastPartnerHeartbeat = simTime();
+        detector.heartbeat(simTime().dbl());
+        armSuspectTimer();
+    }
+
+    // Suspicion is decided on arrival: the timer is moved to the moment phi
+    // would reach the threshold, capped by failoverTimeout
+    void armSuspectTimer() {
+        if (clustered) return;  // members are checked on the heartbeat tick
+        simtime_t at = lastPartnerHeartbeat + failoverTimeout;
+        if (detector.isCalibrated()) {
+            simtime_t phiAt = detector.suspicionTime(phiThreshold);
+            if (phiAt < at) at = phiAt;
+        }
+        if (at < simTime()) at = simTime();
+        rescheduleAt(at, suspectTimer);
+    }
+
+    void partnerSuspected() {
         simtime_t elapsed = simTime() - lastPartnerHeartbeat;
 
-        if (elapsed > failoverTimeout && partnerAlive) {
-            EV << "\n!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n";
-            EV << "WARN: [" << simTime() << "] " << getFullName()
-               << " PARTNER FAILURE DETECTED!\n";
-            EV << "      Last heartbeat was " << elapsed << "s ago\n";
-            EV << "      Taking over as ACTIVE server...\n";
-            EV << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n";
+        if (partnerAlive) {
+            emit(detectionTimeSignal, elapsed);
+            DLOG_DETAIL << "\n!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n";
+            DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                      << " PARTNER FAILURE DETECTED!\n";
+            DLOG_INFO << "      Last heartbeat was " << elapsed << "s ago (phi "
+                      << detector.phi(simTime().dbl()) << ")\n";
+            DLOG_INFO << "      Taking over as ACTIVE server...\n";
+            DLOG_DETAIL << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n\n";
             partnerAlive = false;
 
-            if (!isActive) {
+            if (catchingUp || failbackPending) {
+                // Serve from whatever was copied before the partner went quiet
+                DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                          << " catch-up abandoned after " << catchupReceived << " leases\n";
+                catchingUp = failbackPending = failbackAcked = false;
+            }
+
+            if (loadBalancing) {
+                isActive = true;
+                DHCP_TRACE_EVENT(this, TRACE_TAKEOVER, Ip6Address());
+                awaitingFailoverReply = true;
+                partnerLastSeen = lastPartnerHeartbeat;
+                DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                          << " now serving the partner's hash buckets\n";
+            }
+            else if (!isActive) {
                 isActive = true;
-                EV << "===================================================\n";
-                EV << "INFO: [" << simTime() << "] " << getFullName()
-                   << " is now ACTIVE\n";
-                EV << "      Failover complete - ready to serve requests\n";
-                EV << "===================================================\n\n";
+                DHCP_TRACE_EVENT(this, TRACE_TAKEOVER, Ip6Address());
+                awaitingFailoverReply = true;
+                partnerLastSeen = lastPartnerHeartbeat;
+                DLOG_DETAIL << "===================================================\n";
+                DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                          << " is now ACTIVE\n";
+                DLOG_INFO << "      Failover complete - ready to serve requests\n";
+                DLOG_DETAIL << "===================================================\n\n";
             }
         }
     }
 
     void simulateFailure() {
-        EV << "\n###################################################\n";
-        EV << "WARN: [" << simTime() << "] *** " << getFullName()
-           << " SIMULATING SERVER FAILURE ***\n";
-        EV << "      Server is going DOWN\n";
-        EV << "      Backup should take over within " << failoverTimeout << "s\n";
-        EV << "###################################################\n\n";
+        DHCP_TRACE_EVENT(this, TRACE_FAILURE, Ip6Address());
+        DLOG_DETAIL << "\n###################################################\n";
+        DLOG_INFO << "WARN: [" << simTime() << "] *** " << getFullName()
+                  << " SIMULATING SERVER FAILURE ***\n";
+        DLOG_INFO << "      Server is going DOWN\n";
+        DLOG_INFO << "      Backup should take over within " << failoverTimeout << "s\n";
+        if (recoveryTime >= 0) {
+            DLOG_INFO << "      Server comes back in " << recoveryTime << "s\n";
+        }
+        DLOG_DETAIL << "###################################################\n\n";
         hasFailed = true;
         isActive = false;
+        catchingUp = failbackPending = failbackAcked = false;
+        store.discardPending();  // not committed yet, lost with the crash
 
         if (syncTimer && syncTimer->isScheduled())
             cancelEvent(syncTimer);
         if (heartbeatTimer && heartbeatTimer->isScheduled())
             cancelEvent(heartbeatTimer);
-        if (checkPartnerTimer && checkPartnerTimer->isScheduled())
-            cancelEvent(checkPartnerTimer);
+        if (suspectTimer && suspectTimer->isScheduled())
+            cancelEvent(suspectTimer);
+        if (expiryTimer && expiryTimer->isScheduled())
+            cancelEvent(expiryTimer);
+        if (snapshotTimer && snapshotTimer->isScheduled())
+            cancelEvent(snapshotTimer);
+        flushServiceQueue();
+
+        if (recoveryTime >= 0) {
+            if (!recoveryEvent)
+                recoveryEvent = new cMessage("recoveryEvent");
+            scheduleAt(simTime() + recoveryTime, recoveryEvent);
+        }
+    }
+
+    // Restart after a failure. Leases, offers and pools were lost with the
+    // crash; only the journal position survives, so the partner's acks stay
+    // meaningful. With a local store the table and both positions come back
+    // from disk and the partner only supplies what changed since. No client
+    // is answered until the catch-up is complete.
+    void recover() {
+        if (clustered) {
+            rejoinCluster();
+            return;
+        }
+        DLOG_DETAIL << "\n###################################################\n";
+        DLOG_INFO << "INFO: [" << simTime() << "] *** " << getFullName()
+                  << " RECOVERING ***\n";
+        DLOG_INFO << "      Pulling lease state from the partner\n";
+        DLOG_DETAIL << "###################################################\n\n";
+        hasFailed = false;
+        isActive = false;
+        recoveries++;
+
+        addrTable.clear();
+        addrIndex.clear();
+        offers.clear();      // their wheel entries go stale and are skipped
+        journal.clear();
+        resyncNeeded = false;
+        poolsDirty = false;
+        initPools();
+        catchupFrom = store.isOpen() && loadStore(false) ? peerAppliedSeq : 0;
+        sentSeq = journalSeq;
+        leaseTableChanged();
+
+        partnerAlive = true;
+        partnerActive = true;
+        awaitingFailoverReply = false;
+        detector.reset();
+        lastPartnerHeartbeat = simTime();
+        scheduleAt(simTime() + syncInterval, syncTimer);
+        scheduleAt(simTime() + heartbeatInterval, heartbeatTimer);
+        if (snapshotTimer)
+            scheduleAt(simTime() + leaseSnapshotInterval, snapshotTimer);
+        armSuspectTimer();
+
+        recoveredAt = simTime();
+        catchupReceived = 0;
+        if (!gate("syncOut")->isConnected()) {
+            resumeActive();  // no partner to catch up from
+            return;
+        }
+        catchingUp = true;
+        requestCatchupChunk();
+    }
+
+    void requestCatchupChunk() {
+        auto *req = new DhcpCatchupRequest("DHCP_CATCHUP_REQUEST", DHCP_CATCHUP_REQUEST);
+        req->setOffset(catchupReceived);
+        req->setFromSeq(catchupFrom);
+        sendToPartner(req);
+    }
+
+    // Answers one catch-up request. The first one snapshots the table; the
+    // partner picks up ordinary deltas after the snapshot's journal position.
+    void sendCatchupChunk(DhcpCatchupRequest *req) {
+        if (!gate("syncOut")->isConnected()) return;
+
+        // A partner that restored its own store only needs what the journal
+        // still holds after its position
+        uint64_t from = req->getFromSeq();
+        if (req->getOffset() == 0 && from > 0 && from <= journalSeq
+                && (from == journalSeq || (!journal.empty() && journal.front().seq <= from + 1))) {
+            auto *resume = new DhcpCatchupChunk("DHCP_CATCHUP_CHUNK", DHCP_CATCHUP_CHUNK);
+            resume->setSnapshotSeq(from);
+            resume->setResume(true);
+            resume->setLast(true);
+            sentSeq = from;
+            catchupChunksSent++;
+            sendToPartner(resume);
+            return;
+        }
+
+        if (req->getOffset() == 0) {
+            catchupSnapshot.clear();
+            catchupSnapshot.reserve(addrTable.size());
+            for (const auto& entry : addrTable) {
+                LeaseRecord rec;
+                rec.clientId = entry.first;
+                rec.address = entry.second.address;
+                rec.validUntil = entry.second.validUntil;
+                rec.declined = entry.second.declined;
+                catchupSnapshot.push_back(rec);
+            }
+            catchupSeq = journalSeq;
+            peerAckedSeq = catchupSeq;
+            journal.clear();
+            sentSeq = catchupSeq;
+        }
+
+        size_t offset = std::min((size_t)req->getOffset(), catchupSnapshot.size());
+        size_t count = std::min(catchupSnapshot.size() - offset, (size_t)catchupChunkSize);
+        auto *chunk = new DhcpCatchupChunk("DHCP_CATCHUP_CHUNK", DHCP_CATCHUP_CHUNK);
+        chunk->setSnapshotSeq(catchupSeq);
+        chunk->setOffset(offset);
+        chunk->setTotal(catchupSnapshot.size());
+        chunk->setLast(offset + count == catchupSnapshot.size());
+        chunk->setPcNext(pools[POOL_PC].getNextId());
+        chunk->setMobileNext(pools[POOL_MOBILE].getNextId());
+        chunk->setPrinterNext(pools[POOL_PRINTER].getNextId());
+        chunk->setVipNext(pools[POOL_VIP].getNextId());
+        chunk->setLeasesArraySize(count);
+        for (size_t i = 0; i < count; i++)
+            chunk->setLeases(i, catchupSnapshot[offset + i]);
+        if (chunk->getLast())
+            setLinkCursors(chunk, true);
+
+        if (chunk->getLast()) {
+            catchupSnapshot.clear();
+            catchupSnapshot.shrink_to_fit();
+        }
+        catchupChunksSent++;
+        leaseRecordsSent += count;
+        emit(syncSizeSignal, (long)(SYNC_HEADER_BYTES + LEASE_RECORD_BYTES * count));
+        sendToPartner(chunk);
+    }
+
+    void receiveCatchupChunk(DhcpCatchupChunk *chunk) {
+        if (!catchingUp || (size_t)chunk->getOffset() != catchupReceived) return;  // stale
+        if (chunk->getResume()) {
+            finishCatchup(chunk->getSnapshotSeq());
+            return;
+        }
+        auto wallStart = std::chrono::steady_clock::now();
+        if (chunk->getOffset() == 0 && catchupFrom > 0) {
+            // Too far behind for deltas: the full table replaces the local one
+            addrTable.clear();
+            addrIndex.clear();
+            initPools();
+        }
+
+        pools[POOL_PC].advanceTo(chunk->getPcNext());
+        pools[POOL_MOBILE].advanceTo(chunk->getMobileNext());
+        pools[POOL_PRINTER].advanceTo(chunk->getPrinterNext());
+        pools[POOL_VIP].advanceTo(chunk->getVipNext());
+        applyLinkCursors(chunk);
+        for (size_t i = 0; i < chunk->getLeasesArraySize(); i++) {
+            const LeaseRecord& rec = chunk->getLeases(i);
+            applyPeerRecord(rec);
+        }
+        catchupReceived += chunk->getLeasesArraySize();
+        catchupChunksReceived++;
+        leaseTableChanged();
+
+        if (chunk->getLast()) {
+            compactStore();  // rather than keep the whole stream in the journal
+            catchupApplyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+            finishCatchup(chunk->getSnapshotSeq());
+        }
+        else {
+            catchupApplyTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+            requestCatchupChunk();
+        }
+    }
+
+    // The table is complete up to the partner's journal position snapSeq;
+    // what it journaled during the stream is asked for as a resync
+    void finishCatchup(uint64_t snapSeq) {
+        catchingUp = false;
+        peerAppliedSeq = snapSeq;
+        resyncNeeded = true;
+        simtime_t duration = simTime() - recoveredAt;
+        emit(catchupDurationSignal, duration);
+        emit(catchupLeasesSignal, (long)catchupReceived);
+
+        DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                  << " caught up: " << catchupReceived << " leases in "
+                  << catchupChunksReceived << " chunks, " << duration << "s\n";
+
+        if (loadBalancing || !partnerActive) {
+            resumeActive();
+        }
+        else if (isPrimary && failback) {
+            failbackPending = true;
+            sendToPartner(new DhcpFailbackRequest("DHCP_FAILBACK_REQUEST", DHCP_FAILBACK_REQUEST));
+        }
+        else {
+            sendHeartbeat();
+        }
+    }
+
+    // Partner wants the active role back: stop serving, flush the journal
+    // to it and tell it how far that goes
+    void handOverActive() {
+        if (isActive && !loadBalancing) {
+            isActive = false;
+            awaitingFailoverReply = false;
+            flushServiceQueue();
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " handing the active role back to the partner\n";
+        }
+        sendSync();
+        auto *ack = new DhcpFailbackAck("DHCP_FAILBACK_ACK", DHCP_FAILBACK_ACK);
+        ack->setLastSeq(journalSeq);
+        sendToPartner(ack);
+    }
+
+    void completeFailback() {
+        if (!failbackPending || !failbackAcked || peerAppliedSeq < failbackSeq) return;
+        failbackPending = failbackAcked = false;
+        resumeActive();
+    }
+
+    void resumeActive() {
+        isActive = true;
+        emit(failbackTimeSignal, simTime() - recoveredAt);
+        DLOG_DETAIL << "===================================================\n";
+        DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                  << " is ACTIVE again\n";
+        DLOG_DETAIL << "===================================================\n\n";
+        sendHeartbeat();
+    }
+
+    bool servesShard(int shard) const {
+        return ring.ownerOf(shard) == self && simTime() >= shardReadyAt[shard];
+    }
+
+    int ownedShards() const {
+        int n = 0;
+        for (int s = 0; s < ring.numShards(); s++)
+            if (ring.ownerOf(s) == self) n++;
+        return n;
+    }
+
+    // Fills in the header every peer message carries
+    void sendToPeer(int m, DhcpPeerMessage *msg) {
+        Peer& p = peers[m];
+        msg->setServerId(hostId);
+        msg->setAckSeq(p.appliedSeq);
+        msg->setResyncRequest(p.resyncNeeded);
+        msg->setIsActive(isActive);
+        p.lastSent = simTime();
+        send(msg, "peerOut", m < self ? m : m - 1);
+    }
+
+    // Any message from a member counts as a heartbeat
+    void handleClusterMessage(DhcpPeerMessage *msg) {
+        int m = ring.memberOf(msg->getServerId());
+        if (m < 0 || m == self) return;
+        Peer& p = peers[m];
+        p.lastHeard = simTime();
+        if (!p.alive) {
+            p.alive = true;
+            DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                      << " cluster member " << ring.hostIdOf(m) << " is back\n";
+            membershipChanged(m, true);
+        }
+        else if (msg->getKind() == DHCP_HEARTBEAT && check_and_cast<DhcpHeartbeat *>(msg)->getRejoin()) {
+            // Restarted before it was missed: it gets its shards like a new member
+            membershipChanged(m, true);
+        }
+
+        uint64_t ack = msg->getAckSeq();
+        if (ack > p.ackedSeq) {
+            p.ackedSeq = ack;
+            trimJournal();
+        }
+        if (msg->getResyncRequest() && ack < p.sentSeq)
+            p.sentSeq = ack;
+
+        if (msg->getKind() == DHCP_SYNC)
+            receiveClusterSync(m, check_and_cast<DhcpSync *>(msg));
+        else if (msg->getKind() == DHCP_SHARD_TRANSFER)
+            replaceShards(check_and_cast<DhcpShardTransfer *>(msg));
+    }
+
+    // Journal entries every live member confirmed
+    void trimJournal() {
+        uint64_t upTo = journalSeq;
+        for (int m = 0; m < ring.size(); m++)
+            if (m != self && peers[m].alive)
+                upTo = std::min(upTo, peers[m].ackedSeq);
+        while (!journal.empty() && journal.front().seq <= upTo)
+            journal.pop_front();
+    }
+
+    // One SYNC per live member whenever there are new changes: those of
+    // the shards it holds a copy of, or, once the journal no longer reaches
+    // back to its last SYNC, every lease of the shards owned here that it
+    // holds. Disjoint pool slices leave no cursors to ship.
+    void sendClusterSyncs() {
+        for (int m = 0; m < ring.size(); m++) {
+            Peer& p = peers[m];
+            if (m == self || !p.alive) continue;
+            if (journalSeq == p.sentSeq) {
+                syncsSkipped++;
+                continue;
+            }
+
+            auto *sync = new DhcpSync("DHCP_SYNC", DHCP_SYNC);
+            sync->setFirstSeq(p.sentSeq + 1);
+            sync->setLastSeq(journalSeq);
+            bool full = journal.empty() || journal.front().seq > p.sentSeq + 1;
+            sync->setFullSnapshot(full);
+            if (full) {
+                vector<int> shards;
+                for (int s = 0; s < ring.numShards(); s++)
+                    if (ring.ownerOf(s) == self && ring.holds(s, m)) shards.push_back(s);
+                fillShards(sync, shards);
+                snapshotsSent++;
+            }
+            else {
+                for (size_t i = p.sentSeq + 1 - journal.front().seq; i < journal.size(); i++) {
+                    const JournalEntry& e = journal[i];
+                    if (!ring.holds(ring.shardOf(e.clientId), m)) continue;
+                    LeaseRecord rec;
+                    rec.clientId = e.clientId;
+                    rec.address = e.address;
+                    rec.validUntil = e.validUntil;
+                    rec.declined = e.declined;
+                    sync->appendLeases(rec);
+                }
+            }
+
+            leaseRecordsSent += sync->getLeasesArraySize();
+            emit(syncSizeSignal, (long)(SYNC_HEADER_BYTES + LEASE_RECORD_BYTES * sync->getLeasesArraySize()));
+            syncsSent++;
+            p.sentSeq = journalSeq;
+            sendToPeer(m, sync);
+        }
+        poolsDirty = false;
+    }
+
+    // Deltas may skip sequence numbers, as they only carry the shards held
+    // here, so a gap shows in firstSeq alone. An entry is the whole state
+    // of one lease: replaying entries already applied is harmless.
+    void receiveClusterSync(int m, DhcpSync *msg) {
+        Peer& p = peers[m];
+        if (msg->getFullSnapshot()) {
+            replaceShards(msg);
+        }
+        else if (msg->getFirstSeq() > p.appliedSeq + 1) {
+            p.resyncNeeded = true;  // resent from our ack
+            return;
+        }
+        else {
+            for (size_t i = 0; i < msg->getLeasesArraySize(); i++) {
+                const LeaseRecord& rec = msg->getLeases(i);
+                applyPeerRecord(rec);
+            }
+            leaseTableChanged();
+        }
+        p.appliedSeq = std::max(p.appliedSeq, (uint64_t)msg->getLastSeq());
+        p.resyncNeeded = false;
+    }
+
+    // Lists shards in msg and adds every lease of them, own or mirrored
+    template <typename M>
+    void fillShards(M *msg, const vector<int>& shards) {
+        vector<bool> listed(ring.numShards(), false);
+        msg->setShardsArraySize(shards.size());
+        for (size_t i = 0; i < shards.size(); i++) {
+            msg->setShards(i, shards[i]);
+            listed[shards[i]] = true;
+        }
+        for (const auto& entry : addrTable) {
+            if (!listed[ring.shardOf(entry.first)]) continue;
+            LeaseRecord rec;
+            rec.clientId = entry.first;
+            rec.address = entry.second.address;
+            rec.validUntil = entry.second.validUntil;
+            rec.declined = entry.second.declined;
+            msg->appendLeases(rec);
+        }
+    }
+
+    // A complete copy of the listed shards replaces what is mirrored here
+    // of them, and own leases of those this server no longer owns. A
+    // gained shard is answered from now on.
+    template <typename M>
+    void replaceShards(const M *msg) {
+        vector<bool> listed(ring.numShards(), false);
+        for (size_t i = 0; i < msg->getShardsArraySize(); i++) {
+            int s = msg->getShards(i);
+            if (s < 0 || s >= ring.numShards()) continue;
+            listed[s] = true;
+            shardReadyAt[s] = SIMTIME_ZERO;
+        }
+        for (auto it = addrTable.begin(); it != addrTable.end(); ) {
+            int s = ring.shardOf(it->first);
+            if (!listed[s] || (!it->second.peer && ring.ownerOf(s) == self)) { ++it; continue; }
+            releaseAddress(it->second.address);
+            addrIndex.erase(it->second.address, it->first);
+            persist(it->first, Ip6Address(), SIMTIME_ZERO, true);
+            it = addrTable.erase(it);
+        }
+        for (size_t i = 0; i < msg->getLeasesArraySize(); i++) {
+            const LeaseRecord& rec = msg->getLeases(i);
+            applyPeerRecord(rec);
+        }
+        leaseTableChanged();
     }
 
-    bool isVipClient(const string& type, int prio) const {
-        if (type == "server" || type == "router") return true;
-        if (prio >= vipPriorityCutoff) return true;
-        return false;
+    // Heartbeats to members that got nothing else lately; a member silent
+    // for failoverTimeout leaves the ring
+    void clusterTick() {
+        for (int m = 0; m < ring.size(); m++) {
+            if (m == self) continue;
+            Peer& p = peers[m];
+            if (p.alive && simTime() - p.lastHeard > failoverTimeout) {
+                p.alive = false;
+                emit(detectionTimeSignal, simTime() - p.lastHeard);
+                DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                          << " cluster member " << ring.hostIdOf(m) << " silent for "
+                          << simTime() - p.lastHeard << "s, taking it out of the ring\n";
+                membershipChanged(m, false);
+                trimJournal();
+            }
+            if (simTime() - p.lastSent < heartbeatInterval) {
+                heartbeatsSuppressed++;
+                continue;
+            }
+            heartbeatsSent++;
+            sendToPeer(m, new DhcpHeartbeat("DHCP_HEARTBEAT", DHCP_HEARTBEAT));
+        }
     }
 
-    string pickPrefix(const string& type, int prio) const {
-        if (isVipClient(type, prio)) return vipPrefix;
-        if (type == "pc")      return pcPrefix;
-        if (type == "mobile")  return mobilePrefix;
-        if (type == "printer") return printerPrefix;
-        return pcPrefix;
+    // Member m left or joined the ring: the placement before is that of
+    // the ring with it in the opposite state
+    void membershipChanged(int m, bool alive) {
+        ring.setAlive(m, !alive);
+        ring.rebuild();
+        vector<int> before = ring.placement();
+        ring.setAlive(m, alive);
+        ring.rebuild();
+        rebalance(before);
     }
 
-    string makeAddress(const string& prefixWithLen, uint64_t counter) const {
-        auto slash = prefixWithLen.find('/');
-        string pref = (slash==string::npos) ? prefixWithLen : prefixWithLen.substr(0, slash);
-        if (pref.size() < 2 || pref.substr(pref.size()-2) != "::") {
-            if (!pref.empty() && pref.back() == ':') pref += ":";
-            else pref += "::";
+    // Only shards whose placement changed move. Of each, the old owner, or
+    // the new one if the old owner is gone and it held a copy, sends the
+    // shard's leases to every member that holds it now but did not before.
+    // A shard gained here without a copy waits up to failoverTimeout for
+    // them before it is answered.
+    void rebalance(const vector<int>& before) {
+        int copies = ring.numCopies();
+        vector<vector<int>> gained(ring.size());
+        for (int s = 0; s < ring.numShards(); s++) {
+            const int *old = &before[(size_t)s * copies];
+            const int *now = &ring.placement()[(size_t)s * copies];
+            bool heldBefore = std::find(old, old + copies, self) != old + copies;
+            bool owner = now[0] == self;
+            if (owner && !heldBefore)
+                shardReadyAt[s] = simTime() + failoverTimeout;
+            bool oldOwnerGone = old[0] < 0 || !ring.isAlive(old[0]);
+            if (old[0] != self && !(owner && heldBefore && oldOwnerGone)) continue;
+            for (int k = 0; k < copies; k++) {
+                int m = now[k];
+                if (m >= 0 && m != self && std::find(old, old + copies, m) == old + copies)
+                    gained[m].push_back(s);
+            }
+        }
+
+        long moved = 0;
+        for (int m = 0; m < ring.size(); m++) {
+            if (gained[m].empty()) continue;
+            auto *t = new DhcpShardTransfer("DHCP_SHARD_TRANSFER", DHCP_SHARD_TRANSFER);
+            fillShards(t, gained[m]);
+            moved += gained[m].size();
+            leasesMoved += t->getLeasesArraySize();
+            leaseRecordsSent += t->getLeasesArraySize();
+            emit(syncSizeSignal, (long)(SYNC_HEADER_BYTES + LEASE_RECORD_BYTES * t->getLeasesArraySize()));
+            sendToPeer(m, t);
+        }
+        shardsMoved += moved;
+        membershipChanges++;
+        emit(shardsMovedSignal, moved);
+        DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                  << " ring rebuilt: owns " << ownedShards() << " of " << ring.numShards()
+                  << " shards, sent " << moved << " shard copies\n";
+    }
+
+    // Start of a late member, or restart after a failure, with an empty
+    // table or the local store's. Every member counts as up until it stays
+    // silent. The rejoin heartbeat makes the others send the shards held
+    // here as to a new member; owned ones are answered once they arrived.
+    void rejoinCluster() {
+        DLOG_DETAIL << "\n###################################################\n";
+        DLOG_INFO << "INFO: [" << simTime() << "] *** " << getFullName()
+                  << " JOINING THE CLUSTER ***\n";
+        DLOG_DETAIL << "###################################################\n\n";
+        hasFailed = false;
+        isActive = true;
+        recoveries++;
+
+        addrTable.clear();
+        addrIndex.clear();
+        offers.clear();      // their wheel entries go stale and are skipped
+        journal.clear();
+        poolsDirty = false;
+        initPools();
+        if (store.isOpen()) loadStore(false);
+        leaseTableChanged();
+
+        for (int m = 0; m < ring.size(); m++) {
+            Peer& p = peers[m];
+            p.alive = true;
+            p.lastHeard = simTime();
+            p.sentSeq = p.ackedSeq = journalSeq;
+            p.resyncNeeded = false;
+            ring.setAlive(m, true);
+        }
+        ring.rebuild();
+        for (int s = 0; s < ring.numShards(); s++)
+            shardReadyAt[s] = ring.ownerOf(s) == self ? simTime() + failoverTimeout : SIMTIME_ZERO;
+
+        rescheduleAt(simTime() + syncInterval, syncTimer);
+        rescheduleAt(simTime() + heartbeatInterval, heartbeatTimer);
+        if (snapshotTimer)
+            rescheduleAt(simTime() + leaseSnapshotInterval, snapshotTimer);
+
+        for (int m = 0; m < ring.size(); m++) {
+            if (m == self) continue;
+            auto *hb = new DhcpHeartbeat("DHCP_HEARTBEAT", DHCP_HEARTBEAT);
+            hb->setRejoin(true);
+            heartbeatsSent++;
+            sendToPeer(m, hb);
         }
-        return pref + std::to_string(counter);
     }
 
-    string poolKeyFrom(const string& ip6) const {
-        auto hasPref = [&](const string& pfx) -> bool {
-            auto slash = pfx.find('/');
-            string base = (slash==string::npos) ? pfx : pfx.substr(0, slash);
-            return ip6.rfind(base, 0) == 0;
-        };
-        if (hasPref(vipPrefix))     return vipPrefix;
-        if (hasPref(pcPrefix))      return pcPrefix;
-        if (hasPref(mobilePrefix))  return mobilePrefix;
-        if (hasPref(printerPrefix)) return printerPrefix;
-        return string();
+    static long pageFaults() {
+#ifdef _WIN32
+        return -1;
+#else
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+        return ru.ru_minflt + ru.ru_majflt;
+#endif
+    }
+
+    // Rebuilds the table, pools and replication positions from the local
+    // store into empty tables. Across runs the store's time line is moved
+    // so that the last commit happened just now.
+    bool loadStore(bool carryOver) {
+        auto wallStart = std::chrono::steady_clock::now();
+        long faultsBefore = pageFaults();
+
+        LeaseStore::State state;
+        long records = store.load(state, [this](const LeaseStore::Record& r) {
+            Ip6Address addr(r.addrHi, r.addrLo);
+            if (addr.isUnspecified()) {
+                addrTable.erase(r.clientId);
+                return;
+            }
+            Lease& lease = addrTable[r.clientId];
+            lease.address = addr;
+            lease.validUntil = SimTime::fromRaw(r.time);
+            lease.peer = r.kind == LeaseStore::KIND_PEER;
+            lease.declined = r.kind == LeaseStore::KIND_DECLINED;
+        });
+        if (records < 0) return false;
+
+        simtime_t shift = carryOver ? simTime() - SimTime::fromRaw(state.savedAt) : SIMTIME_ZERO;
+        for (auto it = addrTable.begin(); it != addrTable.end(); ) {
+            Lease& lease = it->second;
+            lease.validUntil += shift;
+            int pool = poolOf(lease.address);
+            if (lease.validUntil <= simTime() || pool < 0 || !pools[pool].reserve(lease.address)) {
+                it = addrTable.erase(it);
+                continue;
+            }
+            addrIndex.set(lease.address, it->first);
+            trackExpiry(it->first, lease);
+            ++it;
+        }
+        for (int i = 0; i < NUM_POOLS; i++)
+            pools[i].advanceTo(state.nextIds[i]);
+        journalSeq = sentSeq = state.journalSeq;
+        peerAppliedSeq = state.peerAppliedSeq;
+        leaseTableChanged();
+
+        storeLoadTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+        storeLoadFaults = pageFaults() - faultsBefore;
+        storeLoadRecords = records;
+        storeLoadLeases = addrTable.size();
+        DLOG_INFO << "INFO: [" << simTime() << "] " << getFullName()
+                  << " loaded " << storeLoadLeases << " leases from " << records
+                  << " stored records in " << storeLoadTime << "s wall clock ("
+                  << storeLoadFaults << " page faults)\n";
+        return true;
+    }
+
+    void compactStore() {
+        if (!store.isOpen() || hasFailed) return;
+        LeaseStore::State state;
+        state.journalSeq = journalSeq;
+        state.peerAppliedSeq = peerAppliedSeq;
+        state.savedAt = simTime().raw();
+        for (int i = 0; i < NUM_POOLS; i++)
+            state.nextIds[i] = pools[i].getNextId();
+        bool ok = store.compact(state, addrTable.size(), [this](LeaseStore::Record *out) {
+            for (const auto& entry : addrTable) {
+                out->kind = entry.second.declined ? LeaseStore::KIND_DECLINED
+                            : entry.second.peer ? LeaseStore::KIND_PEER : LeaseStore::KIND_OWN;
+                out->clientId = entry.first;
+                out->addrHi = entry.second.address.hi;
+                out->addrLo = entry.second.address.lo;
+                out->time = entry.second.validUntil.raw();
+                out++;
+            }
+        });
+        if (ok) {
+            storeSnapshots++;
+        }
+        else {
+            DLOG_INFO << "WARN: [" << simTime() << "] " << getFullName()
+                      << " could not write the lease snapshot\n";
+        }
+    }
+
+    bool isVipClient(int devClass, int prio) const {
+        return isVipClass(devClass, prio, vipPriorityCutoff);
+    }
+
+    int pickPool(int devClass, int prio) const {
+        if (isVipClient(devClass, prio)) return POOL_VIP;
+        if (devClass == DEVCLASS_MOBILE)  return POOL_MOBILE;
+        if (devClass == DEVCLASS_PRINTER) return POOL_PRINTER;
+        return POOL_PC;
+    }
+
+    bool isVipPool(int pool) const {
+        return pool >= 0 && pool % NUM_POOLS == POOL_VIP;
+    }
+
+    int poolOf(const Ip6Address& ip6) const {
+        for (int i = 0; i < NUM_POOLS; i++)
+            if (pools[i].contains(ip6)) return i;
+        int link = linkOf(ip6);
+        return link > 0 ? link * NUM_POOLS + (int)(ip6.hi & (NUM_POOLS - 1)) : -1;
+    }
+
+    // Relayed link whose /62 holds addr, -1 if none
+    int linkOf(const Ip6Address& addr) const {
+        if (numLinks == 0 || !linkBase.contains(addr)) return -1;
+        uint64_t link = (addr.hi & ~linkBase.maskHi()) >> 2;
+        return link >= 1 && link <= (uint64_t)numLinks ? (int)link : -1;
+    }
+
+    // Link pool cursors for the partner: those that moved since the last
+    // SYNC, or every one off its start
+    template <typename M>
+    void setLinkCursors(M *msg, bool all) {
+        vector<int> moved;
+        if (all) {
+            for (size_t p = NUM_POOLS; p < pools.size(); p++)
+                if (pools[p].getNextId() > 1) moved.push_back(p);
+        }
+        else {
+            moved = movedLinkPools;
+        }
+        msg->setLinkCursorsArraySize(moved.size());
+        for (size_t i = 0; i < moved.size(); i++) {
+            PoolCursor& c = msg->getLinkCursorsForUpdate(i);
+            c.pool = moved[i];
+            c.nextId = pools[moved[i]].getNextId();
+        }
+        for (int p : movedLinkPools)
+            linkPoolMoved[p] = false;
+        movedLinkPools.clear();
+    }
+
+    template <typename M>
+    void applyLinkCursors(const M *msg) {
+        for (size_t i = 0; i < msg->getLinkCursorsArraySize(); i++) {
+            const PoolCursor& c = msg->getLinkCursors(i);
+            if (c.pool >= NUM_POOLS && c.pool < (int)pools.size())
+                pools[c.pool].advanceTo(c.nextId);
+        }
+    }
+
+    // A client that already holds a lease or an offer from the right pool
+    // gets the same address again; otherwise a fresh one is allocated.
+    bool makeOffer(int clientId, int pool, Ip6Address& offer) {
+        auto bound = addrTable.find(clientId);
+        if (bound != addrTable.end() && pools[pool].contains(bound->second.address)) {
+            offer = bound->second.address;
+            return true;
+        }
+        auto pending = offers.find(clientId);
+        if (pending != offers.end()) {
+            if (pools[pool].contains(pending->second.address)) {
+                offer = pending->second.address;
+                return true;
+            }
+            releaseAddress(pending->second.address);
+            offers.erase(pending);
+        }
+        if (!pools[pool].allocate(offer)) return false;
+        if (pool >= NUM_POOLS && !linkPoolMoved[pool]) {
+            linkPoolMoved[pool] = true;
+            movedLinkPools.push_back(pool);
+        }
+        Offer& o = offers[clientId];
+        o.address = offer;
+        // An offer nobody requests goes back to the pool
+        o.expiryTick = expiryWheel.insert(clientId, EXPIRE_OFFER, tickOf(simTime() + offerLifetime));
+        armExpiryTimer();
+        poolsDirty = true;
+        return true;
+    }
+
+    // Takes back an offer of an address that was bound or quarantined
+    // under it, so the offer's expiry cannot hand the id back to the pool.
+    // Its wheel entry goes stale and is skipped.
+    void withdrawOffer(const Ip6Address& addr) {
+        for (auto it = offers.begin(); it != offers.end(); ++it) {
+            if (it->second.address == addr) {
+                offers.erase(it);
+                return;
+            }
+        }
+    }
+
+    void releaseAddress(const Ip6Address& addr) {
+        int pool = poolOf(addr);
+        if (pool >= 0) pools[pool].release(addr);
+    }
+
+    // Everything a failover study branches from: leases, offers and pools,
+    // the replication positions and journal, the role and failure state,
+    // the cluster view, the service queue, and every timer except the
+    // failure, which is up to the resumed run. The expiry wheel is rebuilt
+    // from the leases and offers.
+    virtual void saveState(CheckpointWriter& out) override {
+        out.putUint(pools.size());
+        for (const AddressPool& pool : pools) {
+            out.putUint(pool.getNextId());
+            out.putUints(pool.getBitmap());
+            out.putUints(pool.getFreeIds());
+        }
+        out.putUint(movedLinkPools.size());
+        for (int p : movedLinkPools)
+            out.putInt(p);
+
+        out.putUint(addrTable.size());
+        for (const auto& entry : addrTable) {
+            out.putInt(entry.first);
+            out.putAddress(entry.second.address);
+            out.putTime(entry.second.validUntil);
+            out.putBool(entry.second.peer);
+            out.putBool(entry.second.declined);
+        }
+        out.putUint(offers.size());
+        for (const auto& entry : offers) {
+            out.putInt(entry.first);
+            out.putAddress(entry.second.address);
+            out.putTime(entry.second.expiryTick * expiryGranularity);
+        }
+
+        out.putUint(journal.size());
+        for (const JournalEntry& e : journal) {
+            out.putUint(e.seq);
+            out.putInt(e.clientId);
+            out.putAddress(e.address);
+            out.putTime(e.validUntil);
+            out.putBool(e.declined);
+        }
+        out.putUint(journalSeq);
+        out.putUint(sentSeq);
+        out.putUint(peerAckedSeq);
+        out.putUint(peerAppliedSeq);
+        out.putBool(resyncNeeded);
+        out.putBool(poolsDirty);
+        out.putUint(catchupSnapshot.size());
+        for (const LeaseRecord& rec : catchupSnapshot) {
+            out.putInt(rec.clientId);
+            out.putAddress(rec.address);
+            out.putTime(rec.validUntil);
+            out.putBool(rec.declined);
+        }
+        out.putUint(catchupSeq);
+
+        out.putBool(isActive);
+        out.putBool(partnerAlive);
+        out.putBool(partnerActive);
+        out.putTime(lastPartnerHeartbeat);
+        out.putTime(lastSentToPartner);
+        out.putBool(hasFailed);
+        out.putBool(awaitingFailoverReply);
+        out.putTime(partnerLastSeen);
+        out.putBool(catchingUp);
+        out.putTime(recoveredAt);
+        out.putUint(catchupReceived);
+        out.putUint(catchupFrom);
+        out.putBool(failbackPending);
+        out.putBool(failbackAcked);
+        out.putUint(failbackSeq);
+        vector<double> intervals = detector.intervals();
+        out.putUint(intervals.size());
+        for (double interval : intervals)
+            out.putDouble(interval);
+        out.putBool(detector.lastHeartbeat() >= 0);
+        out.putDouble(detector.lastHeartbeat() - simTime().dbl());
+
+        out.putInt(clustered ? ring.size() : 0);
+        for (int m = 0; clustered && m < ring.size(); m++) {
+            const Peer& p = peers[m];
+            out.putBool(ring.isAlive(m));
+            out.putBool(p.alive);
+            out.putTime(p.lastHeard);
+            out.putTime(p.lastSent);
+            out.putUint(p.sentSeq);
+            out.putUint(p.ackedSeq);
+            out.putUint(p.appliedSeq);
+            out.putBool(p.resyncNeeded);
+        }
+        for (simtime_t t : shardReadyAt)
+            out.putTime(t);
+
+        out.putUint(workers.size());
+        for (int c = 0; c < NUM_QCLASSES; c++) {
+            out.putUint(serviceQueue.size(c));
+            for (const Pending& p : serviceQueue.items(c))
+                putPending(out, p);
+        }
+        for (size_t w = 0; w < workers.size(); w++) {
+            out.putTimer(workers[w]);
+            putPending(out, inService[w]);
+        }
+
+        out.putTimer(syncTimer);
+        out.putTimer(heartbeatTimer);
+        out.putTimer(suspectTimer);
+        out.putTimer(snapshotTimer);
+        out.putTimer(recoveryEvent);
+        out.putInFlight(this);
+    }
+
+    virtual void restoreState(CheckpointReader& in) override {
+        if (in.getUint() != pools.size())
+            throw cRuntimeError("The checkpoint has a different number of pools; numLinks must match");
+        for (AddressPool& pool : pools) {
+            uint64_t next = in.getUint();
+            vector<uint64_t> bitmap = in.getUints();
+            pool.restore(next, bitmap, in.getUints());
+        }
+        movedLinkPools.clear();
+        linkPoolMoved.assign(pools.size(), false);
+        for (uint64_t n = in.getUint(); n > 0; n--) {
+            int p = in.getInt();
+            movedLinkPools.push_back(p);
+            linkPoolMoved[p] = true;
+        }
+
+        // In place of whatever the lease store brought; the wheel starts
+        // over at the new time zero
+        addrTable.clear();
+        addrIndex.clear();
+        offers.clear();
+        expiryWheel = TimingWheel();
+        for (uint64_t n = in.getUint(); n > 0; n--) {
+            int clientId = in.getInt();
+            Lease& lease = addrTable[clientId];
+            lease.address = in.getAddress();
+            lease.validUntil = in.getTime();
+            lease.peer = in.getBool();
+            lease.declined = in.getBool();
+            addrIndex.set(lease.address, clientId);
+            trackExpiry(clientId, lease);
+        }
+        for (uint64_t n = in.getUint(); n > 0; n--) {
+            int clientId = in.getInt();
+            Offer& o = offers[clientId];
+            o.address = in.getAddress();
+            o.expiryTick = expiryWheel.insert(clientId, EXPIRE_OFFER, tickOf(in.getTime()));
+        }
+        armExpiryTimer();
+
+        journal.clear();
+        for (uint64_t n = in.getUint(); n > 0; n--) {
+            JournalEntry e;
+            e.seq = in.getUint();
+            e.clientId = in.getInt();
+            e.address = in.getAddress();
+            e.validUntil = in.getTime();
+            e.declined = in.getBool();
+            journal.push_back(e);
+        }
+        journalSeq = in.getUint();
+        sentSeq = in.getUint();
+        peerAckedSeq = in.getUint();
+        peerAppliedSeq = in.getUint();
+        resyncNeeded = in.getBool();
+        poolsDirty = in.getBool();
+        catchupSnapshot.resize(in.getUint());
+        for (LeaseRecord& rec : catchupSnapshot) {
+            rec.clientId = in.getInt();
+            rec.address = in.getAddress();
+            rec.validUntil = in.getTime();
+            rec.declined = in.getBool();
+        }
+        catchupSeq = in.getUint();
+
+        isActive = in.getBool();
+        partnerAlive = in.getBool();
+        partnerActive = in.getBool();
+        lastPartnerHeartbeat = in.getTime();
+        lastSentToPartner = in.getTime();
+        hasFailed = in.getBool();
+        awaitingFailoverReply = in.getBool();
+        partnerLastSeen = in.getTime();
+        catchingUp = in.getBool();
+        recoveredAt = in.getTime();
+        catchupReceived = in.getUint();
+        catchupFrom = in.getUint();
+        failbackPending = in.getBool();
+        failbackAcked = in.getBool();
+        failbackSeq = in.getUint();
+        vector<double> intervals(in.getUint());
+        for (double& interval : intervals)
+            interval = in.getDouble();
+        bool heard = in.getBool();
+        double lastHeartbeat = simTime().dbl() + in.getDouble();
+        detector.restore(intervals, heard ? lastHeartbeat : -1);
+
+        if (in.getInt() != (clustered ? ring.size() : 0))
+            throw cRuntimeError("The checkpoint has a different cluster; clusterSize must match");
+        for (int m = 0; clustered && m < ring.size(); m++) {
+            Peer& p = peers[m];
+            ring.setAlive(m, in.getBool());
+            p.alive = in.getBool();
+            p.lastHeard = in.getTime();
+            p.lastSent = in.getTime();
+            p.sentSeq = in.getUint();
+            p.ackedSeq = in.getUint();
+            p.appliedSeq = in.getUint();
+            p.resyncNeeded = in.getBool();
+        }
+        if (clustered) ring.rebuild();
+        for (simtime_t& t : shardReadyAt)
+            t = in.getTime();
+
+        // A smaller queue in the resumed run drops what does not fit
+        if (in.getUint() != workers.size())
+            throw cRuntimeError("The checkpoint has a different number of serviceWorkers");
+        flushServiceQueue();
+        for (int c = 0; c < NUM_QCLASSES; c++) {
+            for (uint64_t n = in.getUint(); n > 0; n--) {
+                Pending p = getPending(in);
+                Pending evicted;
+                int evictedClass;
+                switch (serviceQueue.push(c, p, evicted, evictedClass)) {
+                    case ServiceQueue<Pending>::DROPPED:
+                        delete p.msg;
+                        break;
+                    case ServiceQueue<Pending>::ADMITTED_EVICTED:
+                        delete evicted.msg;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        for (size_t w = 0; w < workers.size(); w++) {
+            in.getTimer(this, workers[w]);
+            inService[w] = getPending(in);
+        }
+
+        if (!recoveryEvent)
+            recoveryEvent = new cMessage("recoveryEvent");
+        in.getTimer(this, syncTimer);
+        in.getTimer(this, heartbeatTimer);
+        in.getTimer(this, suspectTimer);
+        in.getTimer(this, snapshotTimer);
+        in.getTimer(this, recoveryEvent);
+        in.getInFlight(this);
+
+        lastLeaseCount = 0;
+        leaseTableChanged();
+        compactStore();  // the lease store follows the restored table
+
+        DLOG_INFO << "INFO: " << getFullName() << " resumed with " << addrTable.size()
+                  << " leases, " << (hasFailed ? "failed" : isActive ? "active" : "standby") << "\n";
+    }
+
+    void putPending(CheckpointWriter& out, const Pending& p) const {
+        out.putMessage(p.msg);
+        out.putTime(p.arrival);
+        out.putInt(p.cls);
+        out.putInt(p.origin.relayId);
+        out.putInt(p.origin.link);
+        out.putAddress(p.origin.linkAddress);
+        out.putAddress(p.origin.peerAddress);
+        out.putDuration(p.cost);
+    }
+
+    Pending getPending(CheckpointReader& in) {
+        Pending p;
+        p.msg = in.getMessage();
+        p.arrival = in.getTime();
+        p.cls = in.getInt();
+        p.origin.relayId = in.getInt();
+        p.origin.link = in.getInt();
+        p.origin.linkAddress = in.getAddress();
+        p.origin.peerAddress = in.getAddress();
+        p.cost = in.getDuration();
+        return p;
     }
 
     virtual void finish() override {
+        cancelAndDelete(checkpointTimer);
+        checkpointTimer = nullptr;
+        Checkpoint::instance().detach(this);
         if (syncTimer) {
             cancelAndDelete(syncTimer);
             syncTimer = nullptr;
@@ -373,9 +2611,13 @@ class DHCP : public cSimpleModule {
             cancelAndDelete(heartbeatTimer);
             heartbeatTimer = nullptr;
         }
-        if (checkPartnerTimer) {
-            cancelAndDelete(checkPartnerTimer);
-            checkPartnerTimer = nullptr;
+        if (suspectTimer) {
+            cancelAndDelete(suspectTimer);
+            suspectTimer = nullptr;
+        }
+        if (expiryTimer) {
+            cancelAndDelete(expiryTimer);
+            expiryTimer = nullptr;
         }
         if (failureEvent) {
             if (failureEvent->isScheduled())
@@ -383,31 +2625,142 @@ class DHCP : public cSimpleModule {
             delete failureEvent;
             failureEvent = nullptr;
         }
+        if (recoveryEvent) {
+            cancelAndDelete(recoveryEvent);
+            recoveryEvent = nullptr;
+        }
+        if (snapshotTimer) {
+            cancelAndDelete(snapshotTimer);
+            snapshotTimer = nullptr;
+        }
+        compactStore();  // a clean shutdown leaves a snapshot for the next run
+        store.close();
+        flushServiceQueue();
+        for (cMessage *w : workers)
+            delete w;
+        workers.clear();
 
-        EV << "\n";
-        EV << "========================================\n";
-        EV << "DHCP SERVER STATISTICS: " << getFullName() << "\n";
-        EV << "========================================\n";
-        EV << "Status           : " << (isActive ? "ACTIVE" : "STANDBY") << "\n";
-        EV << "Failed           : " << (hasFailed ? "YES" : "NO") << "\n";
-        EV << "Partner Status   : " << (partnerAlive ? "ALIVE" : "DOWN") << "\n";
-        EV << "----------------------------------------\n";
-        EV << "SOLICIT received : " << solicitsReceived << "\n";
-        EV << "ADVERTISE sent   : " << advertiseSent << "\n";
-        EV << "REQUEST received : " << requestsReceived << "\n";
-        EV << "REPLY sent       : " << repliesSent << "\n";
-        EV << "Total Leases     : " << addrTable.size() << "\n";
-        EV << "========================================\n";
+        DLOG_INFO << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "DHCP SERVER STATISTICS: " << getFullName() << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "Status           : " << (isActive ? "ACTIVE" : "STANDBY")
+                  << (loadBalancing ? " (load balancing)" : "")
+                  << (clustered ? " (cluster)" : "") << "\n";
+        DLOG_INFO << "Failed           : " << (hasFailed ? "YES" : "NO") << "\n";
+        if (clustered) {
+            int live = 1;
+            for (int m = 0; m < ring.size(); m++)
+                if (m != self && peers[m].alive) live++;
+            DLOG_INFO << "Cluster          : member " << self + 1 << " of " << ring.size() << ", "
+                      << live << " live, " << ownedShards() << " of " << ring.numShards() << " shards owned\n";
+            DLOG_INFO << "Shards moved     : " << shardsMoved << " (" << leasesMoved << " leases, "
+                      << membershipChanges << " membership changes)\n";
+        }
+        else {
+            DLOG_INFO << "Partner Status   : " << (partnerAlive ? "ALIVE" : "DOWN") << "\n";
+        }
+        if (recoveries > 0 || catchupChunksSent > 0) {
+            DLOG_INFO << "Catch-up chunks  : " << catchupChunksReceived << " received, "
+                      << catchupChunksSent << " sent (" << recoveries << " recoveries)\n";
+        }
+        DLOG_INFO << "----------------------------------------\n";
+        DLOG_INFO << "SOLICIT received : " << solicitsReceived << "\n";
+        DLOG_INFO << "ADVERTISE sent   : " << advertiseSent << "\n";
+        DLOG_INFO << "REQUEST received : " << requestsReceived << "\n";
+        DLOG_INFO << "REPLY sent       : " << repliesSent << "\n";
+        DLOG_INFO << "RENEW/REBIND recv: " << renewsReceived << "/" << rebindsReceived << "\n";
+        DLOG_INFO << "RELEASE received : " << releasesReceived << "\n";
+        DLOG_INFO << "DECLINE received : " << declinesReceived << " (" << quarantinesLifted << " quarantines lifted)\n";
+        DLOG_INFO << "Conflicts        : " << requestConflicts << " REQUEST, "
+                  << syncConflicts << " from the partner, "
+                  << staleSyncRecords << " stale\n";
+        DLOG_INFO << "Rapid commits    : " << rapidCommits << "\n";
+        DLOG_INFO << "Leases expired   : " << leasesExpired << " (offers " << offersExpired << ")\n";
+        DLOG_INFO << "Total Leases     : " << addrTable.size() << "\n";
+        for (int i = 0; i < NUM_POOLS; i++) {
+            DLOG_INFO << "Pool " << pools[i].getPrefix() << " : " << pools[i].getInUse()
+                      << " in use, next id " << pools[i].getNextId() << "\n";
+        }
+        if (numLinks > 0) {
+            DLOG_INFO << "Relayed          : " << relayedReceived << " messages in " << relayFramesReceived
+                      << " frames, " << relayRepliesSent << " RELAY-REPL sent\n";
+        }
+        DLOG_INFO << "SYNC sent        : " << syncsSent
+                  << " (" << snapshotsSent << " full, " << syncsSkipped << " skipped)\n";
+        DLOG_INFO << "HEARTBEAT sent   : " << heartbeatsSent
+                  << " (" << heartbeatsSuppressed << " covered by SYNC)\n";
+        DLOG_INFO << "Lease records    : " << leaseRecordsSent << "\n";
+        if (!inService.empty()) {
+            DLOG_INFO << "Queue served     : " << queueServed[QCLASS_VIP] << "/" << queueServed[QCLASS_PC]
+                      << "/" << queueServed[QCLASS_MOBILE] << "/" << queueServed[QCLASS_PRINTER]
+                      << " (vip/pc/mobile/printer)\n";
+            DLOG_INFO << "Queue drops      : " << queueDrops[QCLASS_VIP] << "/" << queueDrops[QCLASS_PC]
+                      << "/" << queueDrops[QCLASS_MOBILE] << "/" << queueDrops[QCLASS_PRINTER] << "\n";
+        }
+        DLOG_INFO << "========================================\n";
 
         // Show assigned IPs
-        if (!addrTable.empty()) {
-            EV << "ASSIGNED IP ADDRESSES:\n";
+        if (DHCP_LOG_LEVEL >= DHCP_LOG_DETAIL && !addrTable.empty()) {
+            DLOG_DETAIL << "ASSIGNED IP ADDRESSES:\n";
             for (const auto& entry : addrTable) {
-                EV << "  DeviceID " << entry.first << " -> " << entry.second << "\n";
+                DLOG_DETAIL << "  DeviceID " << entry.first << " -> " << entry.second.address
+                            << " (valid until " << entry.second.validUntil << ")\n";
             }
-            EV << "========================================\n";
+            DLOG_DETAIL << "========================================\n";
+        }
+        DLOG_INFO << "\n";
+
+        TraceRing::instance().detach();
+        profile.finish(this);
+        recordScalar("solicitsReceived", solicitsReceived);
+        recordScalar("advertisesSent", advertiseSent);
+        recordScalar("requestsReceived", requestsReceived);
+        recordScalar("repliesSent", repliesSent);
+        recordScalar("renewsReceived", renewsReceived);
+        recordScalar("rebindsReceived", rebindsReceived);
+        recordScalar("releasesReceived", releasesReceived);
+        recordScalar("declinesReceived", declinesReceived);
+        recordScalar("quarantinesLifted", quarantinesLifted);
+        recordScalar("requestConflicts", requestConflicts);
+        recordScalar("syncConflicts", syncConflicts);
+        recordScalar("staleSyncRecords", staleSyncRecords);
+        recordScalar("leasesExpired", leasesExpired);
+        recordScalar("syncsSent", syncsSent);
+        recordScalar("syncsSkipped", syncsSkipped);
+        recordScalar("heartbeatsSent", heartbeatsSent);
+        recordScalar("heartbeatsSuppressed", heartbeatsSuppressed);
+        recordScalar("controlMessagesSent", syncsSent + heartbeatsSent);
+        recordScalar("snapshotsSent", snapshotsSent);
+        recordScalar("rapidCommits", rapidCommits);
+        recordScalar("relayFramesReceived", relayFramesReceived);
+        recordScalar("relayedMessagesReceived", relayedReceived);
+        recordScalar("relayRepliesSent", relayRepliesSent);
+        recordScalar("recoveries", recoveries);
+        recordScalar("catchupChunksSent", catchupChunksSent);
+        recordScalar("catchupChunksReceived", catchupChunksReceived);
+        if (catchupChunksReceived > 0)
+            recordScalar("catchupApplyTime", catchupApplyTime, "s");
+        if (storeLoadTime >= 0) {
+            recordScalar("storeLoadTime", storeLoadTime, "s");
+            recordScalar("storeLoadRecords", storeLoadRecords);
+            recordScalar("storeLoadPageFaults", storeLoadFaults);
+            recordScalar("storeLoadLeases", storeLoadLeases);
+        }
+        recordScalar("storeSnapshots", storeSnapshots);
+        if (clustered) {
+            recordScalar("shardsOwned", ownedShards());
+            recordScalar("shardsMoved", shardsMoved);
+            recordScalar("leasesMoved", leasesMoved);
+            recordScalar("membershipChanges", membershipChanges);
+        }
+        recordScalar("finalLeaseCount", addrTable.size());
+        recordScalar("wasActive", isActive);
+        recordScalar("hasFailed", hasFailed);
+        for (int c = 0; c < NUM_QCLASSES; c++) {
+            recordScalar((string(qclassName(c)) + "Served").c_str(), queueServed[c]);
+            recordScalar((string(qclassName(c)) + "Drops").c_str(), queueDrops[c]);
         }
-        EV << "\n";
     }
 };
 
@@ -1,142 +1,303 @@
 #include <omnetpp.h>
 #include <string>
 #include "helpers.h"
+#include "ArrivalProcess.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "Checkpoint.h"
 
 using namespace omnetpp;
 using std::string;
 
-class Device : public cSimpleModule {
+class Device : public cSimpleModule, public Checkpointed {
   private:
     string devType;
     string devName;
+    int    devClass = DEVCLASS_PC;
     int    priority = 1;
-    string ip6;
-    long   chosenServerId = 0;
+    int    hostId = 0;             // own address in frames
+    Ip6Address ip6;
+    int    chosenServerId = 0;
     cMessage *startEvt = nullptr;
 
+    // Client state machine (RFC 8415 section 18)
+    enum State { INIT, SELECTING, REQUESTING, BOUND, RENEWING, REBINDING, RELEASED };
+    State state = INIT;
+    simtime_t t1, t2, leaseExpiry;   // absolute times for the current binding
+    cMessage *leaseTimer = nullptr;  // fires at T1, then T2, then expiry
+    cMessage *releaseEvt = nullptr;
+    double leaseHoldTime = -1;
+    double rejoinDelay = -1;
+    double declineProbability = 0;
+    simtime_t solicitTime;           // start of the current exchange
+    bool isVip = false;
+
+    // Retransmission (RFC 8415 section 15): the last message sent is kept
+    // and resent with randomized exponential backoff until answered, MRC
+    // transmissions, the first one included, were made or MRD has passed
+    // (0 = no limit).
+    struct Backoff {
+        simtime_t irt, mrt, mrd;
+        int mrc;
+    };
+    Backoff solicitBackoff, requestBackoff, renewBackoff, rebindBackoff;
+    cMessage *retransTimer = nullptr;
+    DhcpMessage *lastSent = nullptr;
+    Backoff backoff;                 // limits of the exchange in progress
+    simtime_t rt;                    // current retransmission timeout
+    simtime_t exchangeStart;         // first transmission of lastSent
+    simtime_t transactionStart;      // base of the elapsed-time option
+    int transmissions = 0;
+    int handshakeRetransmissions = 0;
+    int handshakeMessages = 0;       // sent and used, SOLICIT through REPLY
+    bool rapidCommit = false;        // ask for a two-message exchange
+
+    // Signals
+    simsignal_t handshakeLatencySignal;
+    simsignal_t classLatencySignal;  // vip- or normalHandshakeLatency
+    simsignal_t retransmissionSignal;
+    simsignal_t handshakeRetransmissionsSignal;
+    simsignal_t handshakeMessagesSignal;
+    simsignal_t rapidCommitLatencySignal;
+    simsignal_t fourMessageLatencySignal;
+
     // Statistics
     int solicitsSent = 0;
     int advertisesReceived = 0;
     int requestsSent = 0;
     int repliesReceived = 0;
+    int renewsSent = 0;
+    int rebindsSent = 0;
+    int releasesSent = 0;
+    int declinesSent = 0;
+    int leasesLost = 0;       // bindings ended early: refused renewal or expiry
+    int requestsRefused = 0;  // REQUESTs answered without a binding
+    int retransmissions = 0;
+    int requestsAbandoned = 0;
+    int rapidCommits = 0;
 
     // For sequential processing
     bool dhcpCompleted = false;
     int deviceOrder = 0;  // Order in which device should start
 
+    EventProfile profile;  // with dhcp-profile
+    cMessage *checkpointTimer = nullptr;  // with dhcp-checkpoint-at
+
   protected:
     virtual void initialize() override {
         devType  = par("type").stringValue();
         devName  = par("name").stringValue();
         priority = par("priority").intValue();
+        hostId   = par("hostId").intValue();
+        if (hostId <= 0)
+            throw cRuntimeError("hostId must be positive, 0 addresses every host");
+        devClass = deviceClassFromName(devType.c_str());
+        TraceRing::instance().attach();
+        profile.init();
+
+        // A configured arrival process replaces the start-order scheme
+        // below, and a replayed trace may set the device type as well
+        ArrivalProcess arrivals;
+        arrivals.init(this);
+        int arrivalIndex = par("arrivalIndex").intValue();
+        if (arrivals.traceClass(arrivalIndex) >= 0) {
+            devClass = arrivals.traceClass(arrivalIndex);
+            devType = deviceClassName(devClass);
+        }
+        isVip = isVipClass(devClass, priority, par("vipPriorityCutoff").intValue());
+
+        handshakeLatencySignal = registerSignal("handshakeLatency");
+        classLatencySignal = registerSignal(isVip ? "vipHandshakeLatency" : "normalHandshakeLatency");
+        retransmissionSignal = registerSignal("retransmission");
+        handshakeRetransmissionsSignal = registerSignal("handshakeRetransmissions");
+
+        solicitBackoff = readBackoff("sol");
+        requestBackoff = readBackoff("req");
+        renewBackoff = readBackoff("ren");
+        rebindBackoff = readBackoff("reb");
+
+        rapidCommit = par("rapidCommit").boolValue();
+        handshakeMessagesSignal = registerSignal("handshakeMessages");
+        rapidCommitLatencySignal = registerSignal("rapidCommitLatency");
+        fourMessageLatencySignal = registerSignal("fourMessageLatency");
+
+        leaseHoldTime = par("leaseHoldTime").doubleValue();
+        rejoinDelay = par("rejoinDelay").doubleValue();
+        declineProbability = par("declineProbability").doubleValue();
 
         startEvt = new cMessage("start");
+        leaseTimer = new cMessage("leaseTimer");
+        releaseEvt = new cMessage("release");
+        retransTimer = new cMessage("retransmit");
 
         // Check if this is a manual start time (for failover testing)
         double jitter = par("startJitter").doubleValue();
 
-        if (jitter > 2.0) {
+        if (arrivals.isSet()) {
+            simtime_t at = arrivals.startTime(arrivalIndex);
+            if (at >= SIMTIME_ZERO)
+                scheduleAt(at, startEvt);
+
+            DLOG_INFO << "INFO: [" << simTime() << "] "
+                      << devName << " (" << devType << ", prio=" << priority
+                      << ") ready. " << arrivals.getName() << " arrival at t="
+                      << at << "s\n";
+        } else if (jitter > 2.0) {
             // This is a failover test device with manual start time
             deviceOrder = 99;  // Special marker
             scheduleAt(simTime() + jitter, startEvt);
 
-            EV << "INFO: [" << simTime() << "] "
-               << devName << " (" << devType << ", prio=" << priority
-               << ") ready. FAILOVER TEST DEVICE - Will start at t="
-               << (simTime() + jitter) << "s\n";
+            DLOG_INFO << "INFO: [" << simTime() << "] "
+                      << devName << " (" << devType << ", prio=" << priority
+                      << ") ready. FAILOVER TEST DEVICE - Will start at t="
+                      << (simTime() + jitter) << "s\n";
         } else {
             // Sequential start based on priority
             deviceOrder = 11 - priority;
             double startDelay = (deviceOrder - 1) * 0.3;
             scheduleAt(simTime() + startDelay, startEvt);
 
-            EV << "INFO: [" << simTime() << "] "
-               << devName << " (" << devType << ", prio=" << priority
-               << ", order=" << deviceOrder << ") ready. Will start at t="
-               << (simTime() + startDelay) << "s\n";
+            DLOG_INFO << "INFO: [" << simTime() << "] "
+                      << devName << " (" << devType << ", prio=" << priority
+                      << ", order=" << deviceOrder << ") ready. Will start at t="
+                      << (simTime() + startDelay) << "s\n";
         }
+        checkpointTimer = Checkpoint::instance().attach(this, this);
     }
 
     virtual void handleMessage(cMessage *msg) override {
-        if (msg->isSelfMessage()) {
-            if (deviceOrder == 99) {
-                EV << "\n*****************************************************\n";
-                EV << "*** FAILOVER TEST: " << devName << " STARTING ***\n";
-                EV << "*** Primary server should be DOWN ***\n";
-                EV << "*** Backup server should be ACTIVE ***\n";
-                EV << "*****************************************************\n";
-            } else {
-                EV << "\n>>> [" << simTime() << "] " << devName
-                   << " STARTING DHCP PROCESS <<<\n";
-            }
+        DHCP_PROFILE_EVENT(profile, msg);
+        if (msg == checkpointTimer) {
+            Checkpoint::instance().take();
+            return;
+        }
 
-            auto *sol = mk("DHCPV6_SOLICIT", DHCPV6_SOLICIT, getId(), 0);
-            sol->addPar("type").setStringValue(devType.c_str());
-            sol->addPar("priority").setLongValue(priority);
-            send(sol, "ppp$o");
-            solicitsSent++;
+        if (msg == leaseTimer) {
+            handleLeaseTimer();
+            return;
+        }
 
-            EV << "INFO: [" << simTime() << "] " << devName
-               << " sent SOLICIT (1/4)\n";
+        if (msg == releaseEvt) {
+            sendRelease();
+            return;
+        }
 
-            delete msg;
+        if (msg == retransTimer) {
+            retransmit();
             return;
         }
 
-        long dst = DST(msg);
-        if (dst != 0 && dst != getId()) {
+        if (msg == startEvt) {
+            if (deviceOrder == 99 && solicitsSent == 0) {
+                DLOG_DETAIL << "\n*****************************************************\n";
+                DLOG_INFO << "*** FAILOVER TEST: " << devName << " STARTING ***\n";
+                DLOG_INFO << "*** Primary server should be DOWN ***\n";
+                DLOG_INFO << "*** Backup server should be ACTIVE ***\n";
+                DLOG_DETAIL << "*****************************************************\n";
+            } else {
+                DLOG_INFO << "\n>>> [" << simTime() << "] " << devName
+                          << " STARTING DHCP PROCESS <<<\n";
+            }
+
+            startSolicit();
+            return;
+        }
+
+        auto *dmsg = check_and_cast<DhcpMessage *>(msg);
+        int dst = DST(dmsg);
+        if (dst != 0 && dst != hostId) {
             delete msg;
             return;
         }
+        DHCP_TRACE_MSG(this, msg);
 
         switch (msg->getKind()) {
             case DHCPV6_ADVERTISE: {
+                auto *adv = check_and_cast<DhcpAdvertise *>(msg);
                 advertisesReceived++;
-                string offer = msg->par("ip6").stringValue();
-                string serverName = msg->hasPar("serverName") ?
-                                   msg->par("serverName").stringValue() : "unknown";
-
-                if (msg->hasPar("serverId")) {
-                    chosenServerId = msg->par("serverId").longValue();
-                } else {
-                    chosenServerId = SRC(msg);
-                }
+                if (state != SELECTING) break;
+                handshakeMessages++;
+                const Ip6Address& offer = adv->getAddress();
+                chosenServerId = adv->getServerId() ? adv->getServerId() : SRC(adv);
 
-                EV << "INFO: [" << simTime() << "] " << devName
-                   << " received ADVERTISE: " << offer
-                   << " from " << serverName << " (2/4)\n";
+                DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                          << " received ADVERTISE: " << offer
+                          << " from server " << chosenServerId << " (2/4)\n";
 
-                auto *req = mk("DHCPV6_REQUEST", DHCPV6_REQUEST, getId(), chosenServerId);
-                req->addPar("ip6").setStringValue(offer.c_str());
-                req->addPar("priority").setLongValue(priority);
-                send(req, "ppp$o");
+                auto *req = mk<DhcpRequest>("DHCPV6_REQUEST", DHCPV6_REQUEST, hostId, chosenServerId);
+                req->setAddress(offer);
+                req->setPriority(priority);
+                transmit(req, requestBackoff);
                 requestsSent++;
+                state = REQUESTING;
 
-                EV << "INFO: [" << simTime() << "] " << devName
-                   << " sent REQUEST for " << offer << " (3/4)\n";
+                DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                          << " sent REQUEST for " << offer << " (3/4)\n";
                 break;
             }
             case DHCPV6_REPLY: {
+                auto *rep = check_and_cast<DhcpReply *>(msg);
                 repliesReceived++;
-                ip6 = msg->par("ip6").stringValue();
-                string serverName = msg->hasPar("serverName") ?
-                                   msg->par("serverName").stringValue() : "unknown";
+                bool committed = state == SELECTING && rep->getRapidCommit();
+                if (state != REQUESTING && state != RENEWING && state != REBINDING && !committed)
+                    break;  // release confirmation or a stray duplicate
+                stopRetransmission();
+
+                if (rep->getValidLifetime() == SIMTIME_ZERO) {
+                    DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                              << " server has no binding for " << rep->getAddress()
+                              << ", restarting DHCP\n";
+                    if (state == RENEWING || state == REBINDING) {
+                        loseLease();
+                    }
+                    else {
+                        requestsRefused++;  // nothing was bound yet
+                        startSolicit();
+                    }
+                    break;
+                }
+
+                bool renewal = (state == RENEWING || state == REBINDING);
+                ip6 = rep->getAddress();
+                chosenServerId = rep->getServerId() ? rep->getServerId() : SRC(rep);
+                bindLease(rep->getValidLifetime(), rep->getPreferredLifetime());
+
+                if (renewal) {
+                    DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                              << " lease on " << ip6 << " extended by server " << chosenServerId
+                              << " until t=" << leaseExpiry << "s\n";
+                    break;
+                }
 
-                EV << "INFO: [" << simTime() << "] " << devName
-                   << " received REPLY and configured IPv6: " << ip6
-                   << " from " << serverName << " (4/4)\n";
+                if (declineProbability > 0 && uniform(0, 1) < declineProbability) {
+                    sendDecline();
+                    break;
+                }
+
+                DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                          << " received REPLY and configured IPv6: " << ip6
+                          << " from server " << chosenServerId << (committed ? " (2/2, rapid commit)\n" : " (4/4)\n");
 
                 dhcpCompleted = true;
+                handshakeMessages++;
+                if (committed) rapidCommits++;
+                emit(handshakeLatencySignal, simTime() - solicitTime);
+                emit(classLatencySignal, simTime() - solicitTime);
+                emit(committed ? rapidCommitLatencySignal : fourMessageLatencySignal, simTime() - solicitTime);
+                emit(handshakeRetransmissionsSignal, (long)handshakeRetransmissions);
+                emit(handshakeMessagesSignal, (long)handshakeMessages);
+                if (leaseHoldTime >= 0)
+                    scheduleAt(simTime() + leaseHoldTime, releaseEvt);
 
                 if (deviceOrder == 99) {
-                    EV << "\n*****************************************************\n";
-                    EV << "*** FAILOVER SUCCESS: " << devName << " got IP from " << serverName << " ***\n";
-                    EV << "*** Assigned IP: " << ip6 << " ***\n";
-                    EV << "*** Backup DHCP server is working correctly! ***\n";
-                    EV << "*****************************************************\n\n";
+                    DLOG_DETAIL << "\n*****************************************************\n";
+                    DLOG_INFO << "*** FAILOVER SUCCESS: " << devName << " got IP from server " << chosenServerId << " ***\n";
+                    DLOG_INFO << "*** Assigned IP: " << ip6 << " ***\n";
+                    DLOG_INFO << "*** Backup DHCP server is working correctly! ***\n";
+                    DLOG_DETAIL << "*****************************************************\n\n";
                 } else {
-                    EV << ">>> [" << simTime() << "] " << devName
-                       << " DHCP PROCESS COMPLETED <<<\n\n";
+                    DLOG_INFO << ">>> [" << simTime() << "] " << devName
+                              << " DHCP PROCESS COMPLETED <<<\n\n";
                 }
                 break;
             }
@@ -146,26 +307,315 @@ class Device : public cSimpleModule {
         delete msg;
     }
 
+    void startSolicit() {
+        auto *sol = mk<DhcpSolicit>("DHCPV6_SOLICIT", DHCPV6_SOLICIT, hostId, 0);
+        sol->setDeviceClass(devClass);
+        sol->setPriority(priority);
+        sol->setRapidCommit(rapidCommit);
+        solicitTime = transactionStart = simTime();
+        handshakeRetransmissions = 0;
+        handshakeMessages = 0;
+        transmit(sol, solicitBackoff);
+        solicitsSent++;
+        state = SELECTING;
+
+        DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                  << " sent SOLICIT (1/4)\n";
+    }
+
+    // T1/T2 follow the RFC 8415 defaults of 0.5 and 0.8 times the
+    // preferred lifetime.
+    void bindLease(simtime_t valid, simtime_t preferred) {
+        state = BOUND;
+        t1 = simTime() + preferred * 0.5;
+        t2 = simTime() + preferred * 0.8;
+        leaseExpiry = simTime() + valid;
+        rescheduleAt(t1, leaseTimer);
+    }
+
+    void handleLeaseTimer() {
+        if (state == BOUND) {
+            auto *ren = mk<DhcpRenew>("DHCPV6_RENEW", DHCPV6_RENEW, hostId, chosenServerId);
+            ren->setAddress(ip6);
+            ren->setPriority(priority);
+            transactionStart = simTime();
+            transmit(ren, renewBackoff, t2 - simTime());
+            renewsSent++;
+            state = RENEWING;
+            scheduleAt(t2, leaseTimer);
+
+            DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                      << " T1 reached, sent RENEW for " << ip6 << "\n";
+        }
+        else if (state == RENEWING) {
+            auto *reb = mk<DhcpRebind>("DHCPV6_REBIND", DHCPV6_REBIND, hostId, 0);
+            reb->setAddress(ip6);
+            reb->setPriority(priority);
+            transmit(reb, rebindBackoff, leaseExpiry - simTime());
+            rebindsSent++;
+            state = REBINDING;
+            scheduleAt(leaseExpiry, leaseTimer);
+
+            DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                      << " T2 reached, sent REBIND for " << ip6 << "\n";
+        }
+        else if (state == REBINDING) {
+            DLOG_INFO << "WARN: [" << simTime() << "] " << devName
+                      << " lease on " << ip6 << " expired, restarting DHCP\n";
+            loseLease();
+        }
+    }
+
+    void loseLease() {
+        leasesLost++;
+        ip6 = Ip6Address();
+        cancelEvent(leaseTimer);
+        cancelEvent(releaseEvt);  // the next binding schedules its own
+        startSolicit();
+    }
+
+    Backoff readBackoff(const char *prefix) {
+        string p = prefix;
+        Backoff b;
+        b.irt = par((p + "Timeout").c_str()).doubleValue();
+        b.mrt = par((p + "MaxRt").c_str()).doubleValue();
+        b.mrc = par((p + "MaxRc").c_str()).intValue();
+        b.mrd = par((p + "MaxRd").c_str()).doubleValue();
+        return b;
+    }
+
+    // Sends msg as the first transmission of a new exchange. The limits
+    // may be tightened by maxDuration, e.g. RENEW only runs until T2.
+    void transmit(DhcpMessage *msg, const Backoff& limits, simtime_t maxDuration = SIMTIME_ZERO) {
+        stopRetransmission();
+        backoff = limits;
+        if (maxDuration > SIMTIME_ZERO && (backoff.mrd == SIMTIME_ZERO || maxDuration < backoff.mrd))
+            backoff.mrd = maxDuration;
+        exchangeStart = simTime();
+        transmissions = 1;
+
+        // The first SOLICIT timeout must be strictly greater than IRT
+        double rand = msg->getKind() == DHCPV6_SOLICIT ? uniform(0, 0.1) : uniform(-0.1, 0.1);
+        rt = backoff.irt + rand * backoff.irt;
+
+        msg->setElapsedTime(elapsedHundredths());
+        if (msg->getKind() == DHCPV6_SOLICIT || msg->getKind() == DHCPV6_REQUEST)
+            handshakeMessages++;
+        if (backoff.irt > SIMTIME_ZERO) {
+            lastSent = msg->dup();
+            DHCP_PROFILE_DUPS(profile, 1);
+            scheduleRetransmission();
+        }
+        send(msg, "ppp$o");
+    }
+
+    void scheduleRetransmission() {
+        simtime_t at = simTime() + rt;
+        if (backoff.mrd > SIMTIME_ZERO && at > exchangeStart + backoff.mrd)
+            at = exchangeStart + backoff.mrd;
+        scheduleAt(at, retransTimer);
+    }
+
+    void retransmit() {
+        bool outOfTries = backoff.mrc > 0 && transmissions >= backoff.mrc;
+        bool outOfTime = backoff.mrd > SIMTIME_ZERO && simTime() >= exchangeStart + backoff.mrd;
+        if (outOfTries || outOfTime) {
+            exchangeFailed();
+            return;
+        }
+
+        rt = 2 * rt + uniform(-0.1, 0.1) * rt;
+        if (backoff.mrt > SIMTIME_ZERO && rt > backoff.mrt)
+            rt = backoff.mrt + uniform(-0.1, 0.1) * backoff.mrt;
+
+        DhcpMessage *copy = lastSent->dup();
+        DHCP_PROFILE_DUPS(profile, 1);
+        copy->setElapsedTime(elapsedHundredths());
+        send(copy, "ppp$o");
+        transmissions++;
+        retransmissions++;
+        if (state == SELECTING || state == REQUESTING) {
+            handshakeRetransmissions++;
+            handshakeMessages++;
+        }
+        emit(retransmissionSignal, (long)copy->getKind());
+        scheduleRetransmission();
+
+        DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                  << " retransmitted " << copy->getName()
+                  << " (attempt " << transmissions << ", next timeout " << rt << "s)\n";
+    }
+
+    // Only a REQUEST that runs out of tries needs handling here; RENEW and
+    // REBIND just go quiet and leave the next step to the lease timer.
+    void exchangeFailed() {
+        short kind = lastSent->getKind();
+        stopRetransmission();
+        if (kind == DHCPV6_REQUEST && state == REQUESTING) {
+            requestsAbandoned++;
+            DLOG_INFO << "WARN: [" << simTime() << "] " << devName
+                      << " REQUEST unanswered, restarting DHCP\n";
+            startSolicit();
+        }
+    }
+
+    void stopRetransmission() {
+        if (retransTimer && retransTimer->isScheduled())
+            cancelEvent(retransTimer);
+        delete lastSent;
+        lastSent = nullptr;
+    }
+
+    uint16_t elapsedHundredths() const {
+        double cs = (simTime() - transactionStart).dbl() * 100;
+        return cs >= 0xffff ? 0xffff : (uint16_t)cs;
+    }
+
+    void sendRelease() {
+        if (state != BOUND && state != RENEWING && state != REBINDING) return;
+
+        auto *rel = mk<DhcpRelease>("DHCPV6_RELEASE", DHCPV6_RELEASE, hostId, chosenServerId);
+        rel->setAddress(ip6);
+        send(rel, "ppp$o");
+        releasesSent++;
+
+        DLOG_INFO << "INFO: [" << simTime() << "] " << devName
+                  << " released " << ip6 << "\n";
+
+        state = RELEASED;
+        ip6 = Ip6Address();
+        cancelEvent(leaseTimer);
+        stopRetransmission();
+        if (rejoinDelay >= 0)
+            scheduleAt(simTime() + rejoinDelay, startEvt);
+    }
+
+    // Duplicate address detection found the new address in use on the link:
+    // hand it back and start over
+    void sendDecline() {
+        auto *dec = mk<DhcpDecline>("DHCPV6_DECLINE", DHCPV6_DECLINE, hostId, chosenServerId);
+        dec->setAddress(ip6);
+        send(dec, "ppp$o");
+        declinesSent++;
+
+        DLOG_INFO << "WARN: [" << simTime() << "] " << devName
+                  << " " << ip6 << " is in use on the link, sent DECLINE\n";
+
+        ip6 = Ip6Address();
+        cancelEvent(leaseTimer);
+        cancelEvent(releaseEvt);  // the next binding schedules its own
+        startSolicit();
+    }
+
+    // The binding, the exchange in progress with its timers and the frames
+    // on their way in; the counters start over in the resumed run
+    virtual void saveState(CheckpointWriter& out) override {
+        out.putInt(state);
+        out.putAddress(ip6);
+        out.putInt(chosenServerId);
+        out.putTime(t1);
+        out.putTime(t2);
+        out.putTime(leaseExpiry);
+        out.putTime(solicitTime);
+        out.putDuration(backoff.irt);
+        out.putDuration(backoff.mrt);
+        out.putDuration(backoff.mrd);
+        out.putInt(backoff.mrc);
+        out.putDuration(rt);
+        out.putTime(exchangeStart);
+        out.putTime(transactionStart);
+        out.putInt(transmissions);
+        out.putInt(handshakeRetransmissions);
+        out.putInt(handshakeMessages);
+        out.putBool(dhcpCompleted);
+        out.putMessage(lastSent);
+        out.putTimer(startEvt);
+        out.putTimer(leaseTimer);
+        out.putTimer(releaseEvt);
+        out.putTimer(retransTimer);
+        out.putInFlight(this);
+    }
+
+    virtual void restoreState(CheckpointReader& in) override {
+        state = (State)in.getInt();
+        ip6 = in.getAddress();
+        chosenServerId = in.getInt();
+        t1 = in.getTime();
+        t2 = in.getTime();
+        leaseExpiry = in.getTime();
+        solicitTime = in.getTime();
+        backoff.irt = in.getDuration();
+        backoff.mrt = in.getDuration();
+        backoff.mrd = in.getDuration();
+        backoff.mrc = in.getInt();
+        rt = in.getDuration();
+        exchangeStart = in.getTime();
+        transactionStart = in.getTime();
+        transmissions = in.getInt();
+        handshakeRetransmissions = in.getInt();
+        handshakeMessages = in.getInt();
+        dhcpCompleted = in.getBool();
+        delete lastSent;
+        lastSent = check_and_cast_nullable<DhcpMessage *>(in.getMessage());
+        in.getTimer(this, startEvt);
+        in.getTimer(this, leaseTimer);
+        in.getTimer(this, releaseEvt);
+        in.getTimer(this, retransTimer);
+        in.getInFlight(this);
+    }
+
     virtual void finish() override {
-        if (startEvt && startEvt->isScheduled()) cancelAndDelete(startEvt);
-
-        EV << "\n";
-        EV << "========================================\n";
-        EV << "DEVICE STATISTICS: " << devName << "\n";
-        EV << "========================================\n";
-        EV << "Type             : " << devType << "\n";
-        EV << "Priority         : " << priority << "\n";
-        EV << "Device Order     : " << deviceOrder << "\n";
-        EV << "Assigned IPv6    : " << (ip6.empty() ? "NONE" : ip6) << "\n";
-        EV << "----------------------------------------\n";
-        EV << "SOLICIT sent     : " << solicitsSent << "\n";
-        EV << "ADVERTISE recv   : " << advertisesReceived << "\n";
-        EV << "REQUEST sent     : " << requestsSent << "\n";
-        EV << "REPLY received   : " << repliesReceived << "\n";
-        EV << "DHCP Completed   : " << (dhcpCompleted ? "YES" : "NO") << "\n";
-        EV << "Status           : " << (ip6.empty() ? "FAILED" : "SUCCESS") << "\n";
-        EV << "========================================\n";
-        EV << "\n";
+        cancelAndDelete(checkpointTimer);
+        checkpointTimer = nullptr;
+        Checkpoint::instance().detach(this);
+        cancelAndDelete(startEvt);
+        cancelAndDelete(leaseTimer);
+        cancelAndDelete(releaseEvt);
+        stopRetransmission();
+        cancelAndDelete(retransTimer);
+        startEvt = leaseTimer = releaseEvt = retransTimer = nullptr;
+        TraceRing::instance().detach();
+        profile.finish(this);
+
+        DLOG_INFO << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "DEVICE STATISTICS: " << devName << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "Type             : " << devType << "\n";
+        DLOG_INFO << "Priority         : " << priority << "\n";
+        DLOG_INFO << "Device Order     : " << deviceOrder << "\n";
+        DLOG_INFO << "Assigned IPv6    : " << (ip6.isUnspecified() ? "NONE" : ip6.str()) << "\n";
+        DLOG_INFO << "----------------------------------------\n";
+        DLOG_INFO << "SOLICIT sent     : " << solicitsSent << "\n";
+        DLOG_INFO << "ADVERTISE recv   : " << advertisesReceived << "\n";
+        DLOG_INFO << "REQUEST sent     : " << requestsSent << "\n";
+        DLOG_INFO << "REPLY received   : " << repliesReceived << "\n";
+        DLOG_INFO << "RENEW/REBIND sent: " << renewsSent << "/" << rebindsSent << "\n";
+        DLOG_INFO << "RELEASE sent     : " << releasesSent << "\n";
+        DLOG_INFO << "DECLINE sent     : " << declinesSent << "\n";
+        DLOG_INFO << "Leases lost      : " << leasesLost << "\n";
+        DLOG_INFO << "REQUEST refused  : " << requestsRefused << "\n";
+        DLOG_INFO << "Rapid commits    : " << rapidCommits << "\n";
+        DLOG_INFO << "Retransmissions  : " << retransmissions
+                  << " (" << requestsAbandoned << " REQUEST exchanges abandoned)\n";
+        DLOG_INFO << "DHCP Completed   : " << (dhcpCompleted ? "YES" : "NO") << "\n";
+        DLOG_INFO << "Status           : " << (dhcpCompleted ? "SUCCESS" : "FAILED") << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "\n";
+
+        recordScalar("priority", priority);
+        recordScalar("vip", isVip);
+        recordScalar("solicitsSent", solicitsSent);
+        recordScalar("requestsSent", requestsSent);
+        recordScalar("renewsSent", renewsSent);
+        recordScalar("rebindsSent", rebindsSent);
+        recordScalar("leasesLost", leasesLost);
+        recordScalar("requestsRefused", requestsRefused);
+        recordScalar("declinesSent", declinesSent);
+        recordScalar("retransmissions", retransmissions);
+        recordScalar("requestsAbandoned", requestsAbandoned);
+        recordScalar("rapidCommits", rapidCommits);
+        recordScalar("completed", dhcpCompleted);
     }
 };
 
@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Phi-accrual failure detector (Hayashibara et al., 2004). Keeps a sliding
+// window of heartbeat inter-arrival times and turns the silence since the
+// last heartbeat into a suspicion level phi = -log10(P(a heartbeat arrives
+// later than this)), under a normal model of the intervals. Times are plain
+// seconds so the class has no simulator dependency.
+class PhiAccrualDetector {
+  private:
+    std::vector<double> window;   // ring of recent intervals
+    size_t next = 0;
+    size_t count = 0;
+    double sum = 0;
+    double sumSq = 0;
+    double minStdDev = 0.05;
+    double pause = 0;             // silence tolerated on top of the model
+    double last = -1;
+
+  public:
+    // Highest phi reported; a threshold must stay below it
+    static constexpr double PHI_MAX = 300;
+
+    void init(size_t windowSize, double minStdDeviation, double acceptablePause) {
+        window.assign(std::max(windowSize, (size_t)2), 0.0);
+        minStdDev = minStdDeviation;
+        pause = acceptablePause;
+        reset();
+    }
+
+    // Forgets all history, e.g. when the peer comes back after a failure
+    void reset() {
+        next = count = 0;
+        sum = sumSq = 0;
+        last = -1;
+    }
+
+    void heartbeat(double now) {
+        if (last >= 0) {
+            double interval = now - last;
+            if (count == window.size()) {
+                double old = window[next];
+                sum -= old;
+                sumSq -= old * old;
+            }
+            else {
+                count++;
+            }
+            window[next] = interval;
+            next = (next + 1) % window.size();
+            sum += interval;
+            sumSq += interval * interval;
+        }
+        last = now;
+    }
+
+    // Intervals in the window, oldest first, for checkpoints
+    std::vector<double> intervals() const {
+        std::vector<double> out;
+        size_t first = count < window.size() ? 0 : next;
+        for (size_t i = 0; i < count; i++)
+            out.push_back(window[(first + i) % window.size()]);
+        return out;
+    }
+
+    // Replays saved intervals, with the last heartbeat at lastAt
+    void restore(const std::vector<double>& saved, double lastAt) {
+        reset();
+        for (double interval : saved) {
+            last = 0;
+            heartbeat(interval);
+        }
+        last = lastAt;
+    }
+
+    // Two intervals are needed before the model means anything
+    bool isCalibrated() const { return count >= 2; }
+    double lastHeartbeat() const { return last; }
+
+    double mean() const { return count ? sum / count : 0; }
+    double stdDev() const {
+        if (count < 2) return minStdDev;
+        double m = mean();
+        double var = std::max(sumSq / count - m * m, 0.0);
+        return std::max(std::sqrt(var), minStdDev);
+    }
+
+    double phi(double now) const {
+        if (!isCalibrated() || last < 0) return 0;
+        double y = (now - last - pause - mean()) / stdDev();
+        double pLater = 0.5 * std::erfc(y / std::sqrt(2.0));
+        if (pLater <= 1e-300) return PHI_MAX;
+        return -std::log10(pLater);
+    }
+
+    // Earliest time phi reaches the threshold if nothing arrives meanwhile;
+    // phi grows monotonically with the silence, so a bisection suffices.
+    // A threshold phi never reaches gives the last bracket tried.
+    double suspicionTime(double threshold) const {
+        double lo = last;
+        double hi = last + pause + mean() + stdDev();
+        for (int i = 0; i < 64 && phi(hi) < threshold; i++) hi += hi - lo;
+        for (int i = 0; i < 60 && hi - lo > 1e-9; i++) {
+            double mid = (lo + hi) / 2;
+            if (phi(mid) < threshold) lo = mid;
+            else hi = mid;
+        }
+        return hi;
+    }
+};
@@ -0,0 +1,187 @@
+#pragma once
+#include <omnetpp.h>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+// IPv6 address held as two host-order 64-bit halves, so it can travel in
+// messages and sit in tables without any string or heap allocation.
+// Text is only parsed at configuration time and produced for logging.
+struct Ip6Address {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    Ip6Address() {}
+    Ip6Address(uint64_t hi, uint64_t lo) : hi(hi), lo(lo) {}
+
+    bool isUnspecified() const { return hi == 0 && lo == 0; }
+    bool isLinkLocal() const { return (hi >> 54) == 0x3fa; }  // fe80::/10
+
+    // fe80::id, the address a host forms on its link from its interface id
+    static Ip6Address linkLocal(uint64_t interfaceId) { return Ip6Address(0xfe80000000000000ULL, interfaceId); }
+
+    bool operator==(const Ip6Address& o) const { return hi == o.hi && lo == o.lo; }
+    bool operator!=(const Ip6Address& o) const { return !(*this == o); }
+    bool operator<(const Ip6Address& o) const { return hi != o.hi ? hi < o.hi : lo < o.lo; }
+
+    // Parses "2001:db8::1" (no embedded IPv4). Parsing stops at an optional
+    // "/len" suffix, whose value is stored in *prefixLen if given.
+    static bool tryParse(const char *text, Ip6Address& result, int *prefixLen = nullptr) {
+        uint16_t head[8], tail[8];
+        int nHead = 0, nTail = 0;
+        bool compressed = false;
+        const char *p = text;
+
+        if (p[0] == ':' && p[1] == ':') {
+            compressed = true;
+            p += 2;
+        }
+        while (*p && *p != '/') {
+            int digits = 0;
+            unsigned value = 0;
+            while (digits < 5) {
+                char c = *p;
+                int v;
+                if (c >= '0' && c <= '9') v = c - '0';
+                else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+                else break;
+                value = (value << 4) | v;
+                digits++;
+                p++;
+            }
+            if (digits == 0 || digits > 4) return false;
+            if (nHead + nTail == 8) return false;
+            if (compressed) tail[nTail++] = value;
+            else head[nHead++] = value;
+
+            if (*p == ':') {
+                if (p[1] == ':') {
+                    if (compressed) return false;
+                    compressed = true;
+                    p += 2;
+                } else {
+                    p++;
+                    if (*p == '\0' || *p == '/') return false;
+                }
+            }
+            else if (*p && *p != '/') return false;
+        }
+        if (!compressed && nHead != 8) return false;
+        if (compressed && nHead + nTail > 7) return false;
+
+        uint16_t groups[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        for (int i = 0; i < nHead; i++) groups[i] = head[i];
+        for (int i = 0; i < nTail; i++) groups[8 - nTail + i] = tail[i];
+
+        int len = 128;
+        if (*p == '/') {
+            p++;
+            if (*p < '0' || *p > '9') return false;
+            len = 0;
+            while (*p >= '0' && *p <= '9') len = len * 10 + (*p++ - '0');
+            if (*p || len > 128) return false;
+        }
+
+        result.hi = result.lo = 0;
+        for (int i = 0; i < 4; i++) result.hi = (result.hi << 16) | groups[i];
+        for (int i = 4; i < 8; i++) result.lo = (result.lo << 16) | groups[i];
+        if (prefixLen) *prefixLen = len;
+        return true;
+    }
+
+    static Ip6Address parse(const char *text, int *prefixLen = nullptr) {
+        Ip6Address a;
+        if (!tryParse(text, a, prefixLen))
+            throw omnetpp::cRuntimeError("Invalid IPv6 address or prefix '%s'", text);
+        return a;
+    }
+
+    uint16_t group(int i) const {
+        return (uint16_t)((i < 4 ? hi : lo) >> (16 * (3 - (i & 3))));
+    }
+
+    // RFC 5952 text form: lowercase, longest run of zero groups compressed.
+    std::string str() const {
+        int bestStart = -1, bestLen = 1;
+        for (int i = 0; i < 8;) {
+            if (group(i) != 0) { i++; continue; }
+            int j = i;
+            while (j < 8 && group(j) == 0) j++;
+            if (j - i > bestLen) { bestStart = i; bestLen = j - i; }
+            i = j;
+        }
+
+        char buf[48];
+        char *q = buf;
+        for (int i = 0; i < 8; i++) {
+            if (i == bestStart) {
+                *q++ = ':';
+                if (i == 0) *q++ = ':';
+                i += bestLen - 1;
+                continue;
+            }
+            q += snprintf(q, 6, "%x", group(i));
+            if (i < 7) *q++ = ':';
+        }
+        *q = '\0';
+        return buf;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Ip6Address& a) {
+    return os << a.str();
+}
+
+// Used by the generated message classes when a frame crosses partitions
+// under parallel simulation
+inline void doParsimPacking(omnetpp::cCommBuffer *b, const Ip6Address& a) {
+    b->pack(a.hi);
+    b->pack(a.lo);
+}
+
+inline void doParsimUnpacking(omnetpp::cCommBuffer *b, Ip6Address& a) {
+    b->unpack(a.hi);
+    b->unpack(a.lo);
+}
+
+// Network prefix such as 2001:db8:1::/64. The address is stored with its
+// host bits cleared, so membership is two masked compares.
+struct Ip6Prefix {
+    Ip6Address net;
+    int length = 0;
+
+    Ip6Prefix() {}
+    Ip6Prefix(const Ip6Address& addr, int length) : length(length) {
+        net = Ip6Address(addr.hi & maskHi(), addr.lo & maskLo());
+    }
+
+    uint64_t maskHi() const {
+        if (length >= 64) return ~0ULL;
+        return length == 0 ? 0 : ~0ULL << (64 - length);
+    }
+    uint64_t maskLo() const {
+        return length <= 64 ? 0 : ~0ULL << (128 - length);
+    }
+
+    bool contains(const Ip6Address& a) const {
+        return (a.hi & maskHi()) == net.hi && (a.lo & maskLo()) == net.lo;
+    }
+
+    // index-th prefix of length len inside this one (len <= 64)
+    Ip6Prefix subnet(int len, uint64_t index) const {
+        return Ip6Prefix(Ip6Address(net.hi | index << (64 - len), 0), len);
+    }
+
+    static Ip6Prefix parse(const char *text) {
+        int len = 128;
+        Ip6Address addr = Ip6Address::parse(text, &len);
+        return Ip6Prefix(addr, len);
+    }
+
+    std::string str() const { return net.str() + "/" + std::to_string(length); }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const Ip6Prefix& p) {
+    return os << p.str();
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Ip6Address.h"
+
+// Address -> client id, the reverse of the server's lease table, so that
+// a REQUEST or a replicated lease for an address another client holds is
+// caught with one lookup. Open addressing with linear probing over one
+// flat slot array: a lookup reads one or two adjacent cache lines instead
+// of chasing bucket nodes. Removal shifts the rest of the probe run back
+// instead of leaving tombstones, so runs stay short under lease churn.
+// The table doubles before it gets half full.
+class LeaseIndex {
+  public:
+    enum { NONE = -1 };
+
+  private:
+    struct Slot {
+        uint64_t hi = 0;
+        uint64_t lo = 0;
+        int clientId = NONE;   // NONE = empty
+    };
+    std::vector<Slot> slots;
+    size_t mask = 0;
+    size_t count = 0;
+
+    static size_t home(uint64_t hi, uint64_t lo, size_t mask) {
+        // Pool addresses differ in the low bits of lo; mix everything down
+        uint64_t h = hi * 0x9e3779b97f4a7c15ULL ^ lo;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h & mask;
+    }
+
+    // Slot holding a, or the empty slot that ends its probe run
+    size_t probe(const Ip6Address& a) const {
+        size_t i = home(a.hi, a.lo, mask);
+        while (slots[i].clientId != NONE && (slots[i].hi != a.hi || slots[i].lo != a.lo))
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(capacity, Slot());
+        mask = capacity - 1;
+        for (const Slot& s : old) {
+            if (s.clientId == NONE) continue;
+            size_t i = home(s.hi, s.lo, mask);
+            while (slots[i].clientId != NONE)
+                i = (i + 1) & mask;
+            slots[i] = s;
+        }
+    }
+
+  public:
+    LeaseIndex() { clear(); }
+
+    size_t size() const { return count; }
+
+    void clear() {
+        slots.assign(16, Slot());
+        mask = 15;
+        count = 0;
+    }
+
+    // Client holding a, NONE if it is unbound
+    int find(const Ip6Address& a) const { return slots[probe(a)].clientId; }
+
+    // Binds a to clientId, replacing any previous holder
+    void set(const Ip6Address& a, int clientId) {
+        if ((count + 1) * 2 > slots.size())
+            rehash(slots.size() * 2);
+        Slot& s = slots[probe(a)];
+        if (s.clientId == NONE) count++;
+        s.hi = a.hi;
+        s.lo = a.lo;
+        s.clientId = clientId;
+    }
+
+    // Unbinds a if clientId holds it
+    bool erase(const Ip6Address& a, int clientId) {
+        size_t gap = probe(a);
+        if (slots[gap].clientId == NONE || slots[gap].clientId != clientId) return false;
+        // An entry further down the run moves into the gap unless its home
+        // lies between the gap and itself
+        for (size_t j = (gap + 1) & mask; slots[j].clientId != NONE; j = (j + 1) & mask) {
+            size_t h = home(slots[j].hi, slots[j].lo, mask);
+            if (((j - h) & mask) >= ((j - gap) & mask)) {
+                slots[gap] = slots[j];
+                gap = j;
+            }
+        }
+        slots[gap] = Slot();
+        count--;
+        return true;
+    }
+};
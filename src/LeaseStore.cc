@@ -0,0 +1,225 @@
+#include "LeaseStore.h"
+#include <cstdio>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const uint32_t SNAP_MAGIC = 0x534c4844;     // "DHLS"
+static const uint32_t JOURNAL_MAGIC = 0x4a4c4844;  // "DHLJ"
+
+#ifdef _WIN32
+
+// No mmap without the Win32 file mapping API; the store stays closed
+bool LeaseStore::open(const std::string&) { return false; }
+void LeaseStore::close() {}
+bool LeaseStore::flush(uint64_t, uint64_t, int64_t) { return false; }
+bool LeaseStore::compact(const State&, size_t, const std::function<void(Record *)>&) { return false; }
+long LeaseStore::load(State&, const std::function<void(const Record&)>&) { return -1; }
+bool LeaseStore::startJournal() { return false; }
+
+#else
+
+namespace {
+
+// Read-only mapping of a whole file; empty if it is missing or empty
+struct MappedFile {
+    const char *data = nullptr;
+    size_t size = 0;
+
+    explicit MappedFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                data = (const char *)p;
+                size = st.st_size;
+                madvise(p, size, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+    }
+    ~MappedFile() { if (data) munmap((void *)data, size); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+};
+
+bool writeAll(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool LeaseStore::open(const std::string& base) {
+    close();
+    snapPath = base + ".snap";
+    journalPath = base + ".journal";
+    size_t slash = base.rfind('/');
+    if (slash != std::string::npos && slash > 0)
+        mkdir(base.substr(0, slash).c_str(), 0755);  // one level; EEXIST is fine
+
+    generation = 0;
+    {
+        MappedFile snap(snapPath);
+        SnapshotHeader h;
+        if (snap.size >= sizeof(h)) {
+            memcpy(&h, snap.data, sizeof(h));
+            if (h.magic == SNAP_MAGIC && h.recordSize == sizeof(Record))
+                generation = h.generation;
+        }
+    }
+
+    journalFd = ::open(journalPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if (journalFd < 0) return false;
+
+    // Keep the journal only if it continues this snapshot, and cut off a
+    // torn group after its last COMMIT so later groups do not adopt it
+    size_t keep = 0;
+    {
+        MappedFile journal(journalPath);
+        JournalHeader h;
+        if (journal.size >= sizeof(h)) {
+            memcpy(&h, journal.data, sizeof(h));
+            if (h.magic == JOURNAL_MAGIC && h.recordSize == sizeof(Record) && h.generation == generation) {
+                keep = sizeof(h);
+                const Record *recs = (const Record *)(journal.data + sizeof(h));
+                size_t n = (journal.size - sizeof(h)) / sizeof(Record);
+                for (size_t i = 0; i < n; i++)
+                    if (recs[i].kind == KIND_COMMIT) keep = sizeof(h) + (i + 1) * sizeof(Record);
+            }
+        }
+    }
+    if (keep == 0)
+        return startJournal();
+    if (ftruncate(journalFd, keep) != 0 || lseek(journalFd, 0, SEEK_END) < 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void LeaseStore::close() {
+    if (journalFd >= 0) ::close(journalFd);
+    journalFd = -1;
+    pending.clear();
+}
+
+bool LeaseStore::startJournal() {
+    JournalHeader h = { JOURNAL_MAGIC, (uint32_t)sizeof(Record), generation };
+    if (ftruncate(journalFd, 0) != 0 || lseek(journalFd, 0, SEEK_SET) < 0
+            || !writeAll(journalFd, &h, sizeof(h))) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool LeaseStore::flush(uint64_t journalSeq, uint64_t peerAppliedSeq, int64_t now) {
+    if (!isOpen()) return false;
+    if (pending.empty()) return true;
+    pending.push_back({KIND_COMMIT, 0, journalSeq, peerAppliedSeq, now});
+    bool ok = writeAll(journalFd, pending.data(), pending.size() * sizeof(Record));
+    pending.clear();
+    return ok;
+}
+
+bool LeaseStore::compact(const State& state, size_t count, const std::function<void(Record *)>& fill) {
+    if (!isOpen()) return false;
+    std::string tmpPath = snapPath + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+
+    size_t size = sizeof(SnapshotHeader) + count * sizeof(Record);
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, size) == 0)
+        p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    SnapshotHeader h;
+    h.magic = SNAP_MAGIC;
+    h.recordSize = sizeof(Record);
+    h.generation = generation + 1;
+    h.count = count;
+    h.journalSeq = state.journalSeq;
+    h.peerAppliedSeq = state.peerAppliedSeq;
+    h.savedAt = state.savedAt;
+    memcpy(h.nextIds, state.nextIds, sizeof(h.nextIds));
+    memcpy(p, &h, sizeof(h));
+    fill((Record *)((char *)p + sizeof(h)));
+    bool ok = msync(p, size, MS_SYNC) == 0;
+    munmap(p, size);
+
+    // The rename is the commit point: a crash before it keeps the old
+    // snapshot and journal, one after it finds a journal of the wrong
+    // generation and starts a new one
+    if (!ok || rename(tmpPath.c_str(), snapPath.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    generation = h.generation;
+    pending.clear();
+    return startJournal();
+}
+
+long LeaseStore::load(State& state, const std::function<void(const Record&)>& apply) {
+    long loaded = -1;
+
+    MappedFile snap(snapPath);
+    SnapshotHeader sh;
+    if (snap.size >= sizeof(sh)) {
+        memcpy(&sh, snap.data, sizeof(sh));
+        if (sh.magic == SNAP_MAGIC && sh.recordSize == sizeof(Record) && sh.generation == generation
+                && snap.size >= sizeof(sh) + sh.count * sizeof(Record)) {
+            state.journalSeq = sh.journalSeq;
+            state.peerAppliedSeq = sh.peerAppliedSeq;
+            state.savedAt = sh.savedAt;
+            memcpy(state.nextIds, sh.nextIds, sizeof(state.nextIds));
+            const Record *recs = (const Record *)(snap.data + sizeof(sh));
+            for (uint64_t i = 0; i < sh.count; i++)
+                apply(recs[i]);
+            loaded = sh.count;
+        }
+    }
+
+    // open() already cut the journal back to its last COMMIT
+    MappedFile journal(journalPath);
+    JournalHeader jh;
+    if (journal.size >= sizeof(jh)) {
+        memcpy(&jh, journal.data, sizeof(jh));
+        if (jh.magic == JOURNAL_MAGIC && jh.recordSize == sizeof(Record) && jh.generation == generation) {
+            const Record *recs = (const Record *)(journal.data + sizeof(jh));
+            size_t n = (journal.size - sizeof(jh)) / sizeof(Record);
+            for (size_t i = 0; i < n; i++) {
+                if (recs[i].kind == KIND_COMMIT) {
+                    state.journalSeq = recs[i].addrHi;
+                    state.peerAppliedSeq = recs[i].addrLo;
+                    state.savedAt = recs[i].time;
+                }
+                else {
+                    apply(recs[i]);
+                }
+            }
+            if (n > 0)
+                loaded = (loaded < 0 ? 0 : loaded) + n;
+        }
+    }
+    return loaded;
+}
+
+#endif
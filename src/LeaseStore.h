@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+// Persistent lease table of one server: a binary snapshot plus an
+// append-only journal of the changes made since, both on local disk.
+//
+// Changes are buffered and written as one group per flush(), closed by a
+// COMMIT record; on load, anything after the last COMMIT is a torn write
+// and ignored. compact() replaces the snapshot with the current table and
+// empties the journal. Both files are read through mmap, so a load costs
+// the page faults of the records it walks and no parsing. Writes reach the
+// OS page cache but are not fsync'ed: the failures simulated here are
+// process crashes, not power loss.
+class LeaseStore {
+  public:
+    enum Kind : uint32_t { KIND_OWN = 1, KIND_PEER = 2, KIND_COMMIT = 3, KIND_DECLINED = 4 };
+
+    // Snapshot and journal entry alike. An unspecified address removes the
+    // client's lease; in a COMMIT, addrHi/addrLo carry the sequence numbers.
+    struct Record {
+        uint32_t kind;
+        int32_t  clientId;
+        uint64_t addrHi;    // COMMIT: own journal sequence
+        uint64_t addrLo;    // COMMIT: newest partner change applied
+        int64_t  time;      // raw simtime: lease expiry, or when committed
+    };
+    static_assert(sizeof(Record) == 32, "records are written as-is");
+
+    static const int NUM_POOLS = 4;
+
+    // Replication position and pool state saved with the table
+    struct State {
+        uint64_t journalSeq = 0;
+        uint64_t peerAppliedSeq = 0;
+        uint64_t nextIds[NUM_POOLS] = {};
+        int64_t  savedAt = 0;   // raw simtime of the newest data loaded
+    };
+
+    ~LeaseStore() { close(); }
+
+    // Opens or creates <base>.snap and <base>.journal, creating the last
+    // directory of base if needed; false if the journal cannot be written
+    bool open(const std::string& base);
+    void close();
+    bool isOpen() const { return journalFd >= 0; }
+
+    void append(Kind kind, int clientId, uint64_t addrHi, uint64_t addrLo, int64_t time) {
+        pending.push_back({kind, clientId, addrHi, addrLo, time});
+    }
+
+    // Writes the buffered changes, if any, and a COMMIT for the given position
+    bool flush(uint64_t journalSeq, uint64_t peerAppliedSeq, int64_t now);
+
+    // Drops changes not flushed yet, as a crash would
+    void discardPending() { pending.clear(); }
+
+    // Writes count records through fill(Record *) as the new snapshot and
+    // starts an empty journal; changes still pending are covered by it
+    bool compact(const State& state, size_t count, const std::function<void(Record *)>& fill);
+
+    // Hands every live record to apply, snapshot first, then the journal up
+    // to its last COMMIT. Returns the number of records read, or -1 if
+    // there is no snapshot and no journal to load.
+    long load(State& state, const std::function<void(const Record&)>& apply);
+
+    size_t getPendingCount() const { return pending.size(); }
+
+  private:
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint32_t recordSize;
+        uint64_t generation;
+        uint64_t count;
+        uint64_t journalSeq;
+        uint64_t peerAppliedSeq;
+        int64_t  savedAt;
+        uint64_t nextIds[NUM_POOLS];
+    };
+    struct JournalHeader {
+        uint32_t magic;
+        uint32_t recordSize;
+        uint64_t generation;    // snapshot this journal continues
+    };
+
+    bool startJournal();
+
+    std::string snapPath;
+    std::string journalPath;
+    int journalFd = -1;
+    uint64_t generation = 0;
+    std::vector<Record> pending;
+};
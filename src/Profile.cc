@@ -0,0 +1,158 @@
+#include "Profile.h"
+#include <algorithm>
+
+using namespace omnetpp;
+
+Register_PerRunConfigOption(CFGID_DHCP_PROFILE, "dhcp-profile", CFG_BOOL, "false",
+        "Charge the wall-clock time and message allocations of every event of the "
+        "DHCP modules to its message kind, and record the totals by module type.");
+Register_PerRunConfigOption(CFGID_DHCP_PROFILE_MODULES, "dhcp-profile-modules", CFG_BOOL, "false",
+        "With dhcp-profile, also record the profile of every single module.");
+
+void EventProfile::init() {
+    ProfileTable& table = ProfileTable::instance();
+    table.attach();
+    enabled = table.isEnabled();
+}
+
+void EventProfile::finish(cComponent *owner) {
+    ProfileTable& table = ProfileTable::instance();
+    if (enabled) {
+        if (table.isPerModule()) {
+            std::vector<const EventCost *> own;
+            for (const EventCost& c : costs)
+                own.push_back(&c);
+            recordEventCosts(owner, "profile:", own);
+        }
+        table.merge(owner->getComponentType()->getName(), costs);
+    }
+    costs.clear();
+    enabled = false;
+    table.detach();
+}
+
+EventCost& EventProfile::costOf(const cMessage *msg) {
+    bool self = msg->isSelfMessage();
+    for (EventCost& c : costs) {
+        if (c.self != self) continue;
+        if (self ? c.label == msg->getName() : c.kind == msg->getKind())
+            return c;
+    }
+    costs.emplace_back();
+    EventCost& c = costs.back();
+    c.self = self;
+    c.kind = msg->getKind();
+    c.label = msg->getName();
+    return c;
+}
+
+void recordEventCosts(cComponent *component, const std::string& prefix,
+                      const std::vector<const EventCost *>& costs) {
+    std::vector<double> edges;
+    for (int b = 0; b <= EventCost::NUM_BUCKETS; b++)
+        edges.push_back(b == 0 ? 0 : (double)(1ULL << b) * 1e-9);
+
+    for (const EventCost *c : costs) {
+        std::string name = prefix + c->label;
+        component->recordScalar((name + ":events").c_str(), c->events);
+        component->recordScalar((name + ":wallTime").c_str(), c->wallTime, "s");
+        component->recordScalar((name + ":allocated").c_str(), c->allocated);
+        component->recordScalar((name + ":dups").c_str(), c->dups);
+
+        // Each bucket's events at its midpoint; the edges keep the log2 bins
+        cHistogram hist((name + ":eventWallTime").c_str(), true);
+        hist.setBinEdges(edges);
+        for (int b = 0; b < EventCost::NUM_BUCKETS; b++)
+            if (c->buckets[b] > 0)
+                hist.collectWeighted((edges[b] + edges[b + 1]) / 2, c->buckets[b]);
+        component->recordStatistic(&hist, "s");
+    }
+}
+
+ProfileTable& ProfileTable::instance() {
+    static ProfileTable table;
+    return table;
+}
+
+void ProfileTable::attach() {
+    if (!listening) {
+        getEnvir()->addLifecycleListener(this);
+        listening = true;
+    }
+    if (attached++ > 0) return;
+    cConfiguration *cfg = getEnvir()->getConfig();
+    enabled = DHCP_PROFILE && cfg && cfg->getAsBool(CFGID_DHCP_PROFILE);
+    perModule = enabled && cfg->getAsBool(CFGID_DHCP_PROFILE_MODULES);
+    rows.clear();
+}
+
+void ProfileTable::detach() {
+    if (attached == 0 || --attached > 0) return;
+    if (enabled && !rows.empty()) {
+        record();
+        printSummary();
+    }
+    rows.clear();
+    enabled = false;
+}
+
+void ProfileTable::lifecycleEvent(SimulationLifecycleEventType type, cObject *details) {
+    if (type != LF_PRE_NETWORK_DELETE || attached == 0) return;
+    // The result files of the run are closed by now
+    attached = 0;
+    rows.clear();
+    enabled = perModule = false;
+}
+
+void ProfileTable::merge(const char *type, const std::vector<EventCost>& costs) {
+    for (const EventCost& c : costs) {
+        auto it = std::find_if(rows.begin(), rows.end(), [&](const Row& r) {
+            return r.type == type && r.cost.self == c.self &&
+                   (c.self ? r.cost.label == c.label : r.cost.kind == c.kind);
+        });
+        if (it == rows.end()) {
+            rows.push_back({type, c});
+            continue;
+        }
+        it->cost.merge(c);
+    }
+}
+
+void ProfileTable::record() {
+    // On the network module, which outlives every profiled module
+    cModule *network = getSimulation()->getSystemModule();
+    for (const Row& r : rows)
+        recordEventCosts(network, "profile:" + r.type + ":", {&r.cost});
+}
+
+void ProfileTable::printSummary() const {
+    std::vector<const Row *> order;
+    double total = 0;
+    for (const Row& r : rows) {
+        order.push_back(&r);
+        total += r.cost.wallTime;
+    }
+    std::sort(order.begin(), order.end(), [](const Row *a, const Row *b) {
+        return a->cost.wallTime > b->cost.wallTime;
+    });
+
+    char line[160];
+    EV << "\n";
+    EV << "========================================\n";
+    EV << "EVENT PROFILE (wall clock in handleMessage)\n";
+    EV << "========================================\n";
+    snprintf(line, sizeof(line), "%-36s %10s %9s %6s %9s %8s %8s\n",
+             "type / kind", "events", "seconds", "share", "mean us", "alloc/ev", "dups");
+    EV << line;
+    for (const Row *r : order) {
+        const EventCost& c = r->cost;
+        std::string key = r->type + " " + c.label;
+        snprintf(line, sizeof(line), "%-36.36s %10ld %9.3f %5.1f%% %9.2f %8.2f %8ld\n",
+                 key.c_str(), c.events, c.wallTime, total > 0 ? 100 * c.wallTime / total : 0.0,
+                 c.events ? 1e6 * c.wallTime / c.events : 0.0,
+                 c.events ? (double)c.allocated / c.events : 0.0, c.dups);
+        EV << line;
+    }
+    EV << "========================================\n";
+    EV << "\n";
+}
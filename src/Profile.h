@@ -0,0 +1,151 @@
+#pragma once
+#include <omnetpp.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// EVENT PROFILE
+// Opt-in cost accounting of the simulation itself, enabled per run with
+// dhcp-profile. Every handleMessage of a profiled module is charged to the
+// kind of message it handled, frames by kind and self-messages by name:
+// the number of events, the wall-clock time spent, as a log2 histogram,
+// and the messages constructed meanwhile (read from cMessage's global
+// counter, so dup() copies are included). Modules also count their dup()
+// copies explicitly. Profiles are summed up by module type into a run-wide
+// table; when the last profiled module finishes, the table is recorded as
+// scalars and histograms of the network module and printed as a short
+// summary, costliest first. dhcp-profile-modules also records each
+// module's own profile. Build with -DDHCP_PROFILE=0 to compile the hooks
+// out.
+// ============================================================================
+#ifndef DHCP_PROFILE
+#define DHCP_PROFILE 1
+#endif
+
+// Cost of the events of one kind
+struct EventCost {
+    enum { NUM_BUCKETS = 32 };   // bucket b: [2^b, 2^(b+1)) ns
+
+    bool self = false;           // keyed by name, else by kind
+    short kind = 0;
+    std::string label;           // frame or timer name
+    long events = 0;
+    double wallTime = 0;         // seconds
+    long allocated = 0;          // messages constructed, dup() included
+    long dups = 0;
+    long buckets[NUM_BUCKETS] = {};
+
+    void add(double seconds) {
+        events++;
+        wallTime += seconds;
+        double ns = seconds * 1e9;
+        int b = 0;
+        while (b < NUM_BUCKETS - 1 && ns >= (double)(2ULL << b))
+            b++;
+        buckets[b]++;
+    }
+
+    void merge(const EventCost& o) {
+        events += o.events;
+        wallTime += o.wallTime;
+        allocated += o.allocated;
+        dups += o.dups;
+        for (int b = 0; b < NUM_BUCKETS; b++)
+            buckets[b] += o.buckets[b];
+    }
+};
+
+class EventProfile {
+  public:
+    // Times one handleMessage. The key is taken up front, as the message
+    // may be gone by the end.
+    class Scope {
+      public:
+        Scope(EventProfile& p, const omnetpp::cMessage *msg) {
+            if (!p.enabled) return;
+            profile = &p;
+            p.current = &p.costOf(msg);
+            allocatedBefore = omnetpp::cMessage::getTotalMessageCount();
+            start = std::chrono::steady_clock::now();
+        }
+        ~Scope() {
+            if (!profile) return;
+            EventCost *cost = profile->current;
+            cost->add(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+            cost->allocated += omnetpp::cMessage::getTotalMessageCount() - allocatedBefore;
+            profile->current = nullptr;
+        }
+
+      private:
+        EventProfile *profile = nullptr;
+        uint64_t allocatedBefore = 0;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Every profiled module calls init() in initialize() and finish() in
+    // finish()
+    void init();
+    void finish(omnetpp::cComponent *owner);
+
+    bool isEnabled() const { return enabled; }
+
+    // dup() copies made by the event in progress
+    void countDups(long n = 1) {
+        if (current) current->dups += n;
+    }
+
+  private:
+    bool enabled = false;
+    std::vector<EventCost> costs;   // a handful of kinds per module, scanned
+    EventCost *current = nullptr;
+
+    EventCost& costOf(const omnetpp::cMessage *msg);
+};
+
+// The run-wide table behind EventProfile. A run that fails before
+// finish() leaves modules attached; the table is dropped unrecorded when
+// its network is deleted, so the next run starts clean.
+class ProfileTable : public omnetpp::cISimulationLifecycleListener {
+  public:
+    static ProfileTable& instance();
+
+    void attach();
+    void detach();
+    bool isEnabled() const { return enabled; }
+    bool isPerModule() const { return perModule; }
+
+    void merge(const char *type, const std::vector<EventCost>& costs);
+
+  protected:
+    virtual void lifecycleEvent(omnetpp::SimulationLifecycleEventType type, omnetpp::cObject *details) override;
+    virtual void listenerRemoved() override { listening = false; }
+
+  private:
+    struct Row {
+        std::string type;
+        EventCost cost;
+    };
+    std::vector<Row> rows;
+    int attached = 0;
+    bool listening = false;
+    bool enabled = false;
+    bool perModule = false;
+
+    void record();
+    void printSummary() const;
+};
+
+// Records each EventCost of costs as scalars and a wall-time histogram of
+// component, names prefixed with prefix
+void recordEventCosts(omnetpp::cComponent *component, const std::string& prefix,
+                      const std::vector<const EventCost *>& costs);
+
+#if DHCP_PROFILE
+#define DHCP_PROFILE_EVENT(profile, msg) EventProfile::Scope _profileScope((profile), (msg))
+#define DHCP_PROFILE_DUPS(profile, n) (profile).countDups(n)
+#else
+#define DHCP_PROFILE_EVENT(profile, msg) do {} while (0)
+#define DHCP_PROFILE_DUPS(profile, n) do {} while (0)
+#endif
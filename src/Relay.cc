@@ -0,0 +1,191 @@
+#include <omnetpp.h>
+#include <vector>
+#include <climits>
+#include "helpers.h"
+#include "Trace.h"
+#include "Profile.h"
+#include "Checkpoint.h"
+
+using namespace omnetpp;
+using std::vector;
+
+// ============================================================================
+// RELAY AGENT
+// Stands between one access segment and the servers (RFC 8415 section 9).
+// Client messages go upstream inside Relay-Forward frames, answers come
+// back inside Relay-Reply frames and are unwrapped onto the segment.
+// Batching is Nagle-like: a message to a server whose last frame left
+// less than batchDelay ago joins the open frame, which goes when it holds
+// batchSize messages or batchDelay after the last one. An idle relay adds
+// no delay.
+// ============================================================================
+class Relay : public cSimpleModule {
+  private:
+    int hostId = 0;
+    Ip6Address linkAddress;
+    vector<int> servers;
+    int batchSize = 1;
+    simtime_t batchDelay;
+
+    // Open frame per server; the timer's kind is the server's index
+    struct Batch {
+        DhcpRelayForward *frame = nullptr;
+        cMessage *timer = nullptr;
+        simtime_t lastSent = -1;
+    };
+    vector<Batch> batches;
+
+    simsignal_t batchSizeSignal;
+
+    // Statistics
+    long messagesRelayed = 0;
+    long copiesForwarded = 0;
+    long framesSent = 0;
+    long repliesRelayed = 0;
+    long framesDropped = 0;
+    long repliesUndeliverable = 0;
+
+    EventProfile profile;  // with dhcp-profile
+
+  protected:
+    virtual void initialize() override {
+        Checkpoint::refuse(this);  // open frames and batch timers are not saved
+        hostId = par("hostId").intValue();
+        if (hostId <= 0)
+            throw cRuntimeError("hostId must be positive, 0 addresses every host");
+        Ip6Prefix base = Ip6Prefix::parse(par("linkBase").stringValue());
+        int linkIndex = par("linkIndex").intValue();
+        if (linkIndex < 1 || base.length > 62 || (uint64_t)linkIndex >= (1ULL << (62 - base.length)))
+            throw cRuntimeError("linkIndex %d does not fit into linkBase %s", linkIndex, base.str().c_str());
+        Ip6Prefix link = base.subnet(62, linkIndex);
+        linkAddress = Ip6Address(link.net.hi, 1);
+
+        servers = cStringTokenizer(par("servers").stringValue()).asIntVector();
+        if (servers.empty())
+            throw cRuntimeError("servers must name at least one server hostId");
+        batchSize = par("batchSize").intValue();
+        batchDelay = par("batchDelay").doubleValue();
+        if (batchSize < 1)
+            throw cRuntimeError("batchSize must be positive, got %d", batchSize);
+
+        batches.resize(servers.size());
+        for (size_t s = 0; s < servers.size(); s++)
+            batches[s].timer = new cMessage("batchTimer", s);
+        batchSizeSignal = registerSignal("relayBatchSize");
+        TraceRing::instance().attach();
+        profile.init();
+    }
+
+    virtual void handleMessage(cMessage *msg) override {
+        DHCP_PROFILE_EVENT(profile, msg);
+        if (msg->isSelfMessage()) {
+            flush(msg->getKind());
+            return;
+        }
+
+        DHCP_TRACE_MSG(this, msg);
+
+        if (msg->arrivedOn("upstream$i")) {
+            auto *reply = dynamic_cast<DhcpRelayReply *>(msg);
+            if (!reply || DST(reply) != hostId) {
+                // Flooded while the switches learn, or not for a relay at all
+                framesDropped++;
+                delete msg;
+                return;
+            }
+            for (size_t i = 0; i < reply->getMessagesArraySize(); i++) {
+                DhcpMessage *inner = reply->removeMessages(i);
+                if (!inner) continue;
+                // The client is found by its link-local address, whatever
+                // the server put into the inner message
+                Ip6Address peer = i < reply->getPeerAddressesArraySize() ? reply->getPeerAddresses(i) : Ip6Address();
+                if (!peer.isLinkLocal() || peer.lo == 0 || peer.lo > INT_MAX) {
+                    repliesUndeliverable++;
+                    delete inner;
+                    continue;
+                }
+                inner->setDstId((int)peer.lo);
+                repliesRelayed++;
+                send(inner, "ppp$o");
+            }
+            delete msg;
+            return;
+        }
+
+        // A client message names its server or goes to all of them
+        auto *dmsg = check_and_cast<DhcpMessage *>(msg);
+        messagesRelayed++;
+        for (size_t s = 0; s < servers.size(); s++) {
+            if (servers[s] == DST(dmsg)) {
+                relay(s, dmsg);
+                return;
+            }
+        }
+        for (size_t s = 0; s + 1 < servers.size(); s++) {
+            relay(s, dmsg->dup());
+            DHCP_PROFILE_DUPS(profile, 1);
+        }
+        relay(servers.size() - 1, dmsg);
+    }
+
+    void relay(int s, DhcpMessage *msg) {
+        Batch& b = batches[s];
+        if (!b.frame) {
+            b.frame = mk<DhcpRelayForward>("DHCPV6_RELAY_FORW", DHCPV6_RELAY_FORW, hostId, servers[s]);
+            b.frame->setLinkAddress(linkAddress);
+        }
+        b.frame->appendMessages(msg);
+        b.frame->appendPeerAddresses(Ip6Address::linkLocal(SRC(msg)));
+        copiesForwarded++;
+
+        bool idle = b.lastSent < SIMTIME_ZERO || simTime() - b.lastSent >= batchDelay;
+        if (idle || (int)b.frame->getMessagesArraySize() >= batchSize)
+            flush(s);
+        else if (!b.timer->isScheduled())
+            scheduleAt(b.lastSent + batchDelay, b.timer);
+    }
+
+    void flush(int s) {
+        Batch& b = batches[s];
+        if (b.timer->isScheduled())
+            cancelEvent(b.timer);
+        if (!b.frame) return;
+        emit(batchSizeSignal, (long)b.frame->getMessagesArraySize());
+        send(b.frame, "upstream$o");
+        b.frame = nullptr;
+        b.lastSent = simTime();
+        framesSent++;
+    }
+
+    virtual void finish() override {
+        for (Batch& b : batches) {
+            cancelAndDelete(b.timer);
+            b.timer = nullptr;
+            delete b.frame;
+            b.frame = nullptr;
+        }
+
+        recordScalar("messagesRelayed", messagesRelayed);
+        recordScalar("relayForwardsSent", framesSent);
+        recordScalar("messagesPerForward", framesSent ? (double)copiesForwarded / framesSent : 0.0);
+        recordScalar("repliesRelayed", repliesRelayed);
+        recordScalar("framesDropped", framesDropped);
+        recordScalar("repliesUndeliverable", repliesUndeliverable);
+
+        DLOG_INFO << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "RELAY STATISTICS: " << getFullName() << " (" << linkAddress << ")\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "Client messages  : " << messagesRelayed << "\n";
+        DLOG_INFO << "RELAY-FORW sent  : " << framesSent << " (" << copiesForwarded << " messages)\n";
+        DLOG_INFO << "Replies relayed  : " << repliesRelayed << " (" << repliesUndeliverable << " undeliverable)\n";
+        DLOG_INFO << "Dropped frames   : " << framesDropped << "\n";
+        DLOG_INFO << "========================================\n";
+        DLOG_INFO << "\n";
+
+        TraceRing::instance().detach();
+        profile.finish(this);
+    }
+};
+
+Define_Module(Relay);
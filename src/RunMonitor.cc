@@ -0,0 +1,91 @@
+#include <omnetpp.h>
+#include <chrono>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include "Profile.h"
+
+using namespace omnetpp;
+
+// ============================================================================
+// RUN MONITOR
+// Records how expensive the run itself was, so scaling regressions show up
+// in the result files next to the protocol statistics. With dhcp-profile it
+// also samples the future event set and the live messages over time.
+// ============================================================================
+class RunMonitor : public cSimpleModule {
+  private:
+    std::chrono::steady_clock::time_point wallStart;
+    int64_t eventsAtStart = 0;
+    cMessage *sampleTimer = nullptr;
+    simtime_t sampleInterval;
+    simsignal_t fesLengthSignal;
+    simsignal_t liveMessagesSignal;
+
+    static double peakRssBytes() {
+#ifdef _WIN32
+        return -1;  // not available without psapi
+#else
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) != 0) return -1;
+#ifdef __APPLE__
+        return (double)ru.ru_maxrss;  // bytes on macOS
+#else
+        return (double)ru.ru_maxrss * 1024;  // kilobytes on Linux
+#endif
+#endif
+    }
+
+  protected:
+    virtual void initialize() override {
+        wallStart = std::chrono::steady_clock::now();
+        eventsAtStart = getSimulation()->getEventNumber();
+        recordScalar("setupPeakRss", peakRssBytes(), "B");
+
+        ProfileTable::instance().attach();
+        sampleInterval = par("profileSampleInterval").doubleValue();
+        if (ProfileTable::instance().isEnabled() && sampleInterval > SIMTIME_ZERO) {
+            fesLengthSignal = registerSignal("fesLength");
+            liveMessagesSignal = registerSignal("liveMessages");
+            sampleTimer = new cMessage("profileSample");
+            scheduleAt(simTime() + sampleInterval, sampleTimer);
+        }
+    }
+
+    virtual void handleMessage(cMessage *msg) override {
+        emit(fesLengthSignal, (long)getSimulation()->getFES()->getLength());
+        emit(liveMessagesSignal, (long)cMessage::getLiveMessageCount());
+        scheduleAt(simTime() + sampleInterval, msg);
+    }
+
+    virtual void finish() override {
+        cancelAndDelete(sampleTimer);
+        sampleTimer = nullptr;
+        ProfileTable::instance().detach();
+
+        double wall = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - wallStart).count();
+        int64_t events = getSimulation()->getEventNumber() - eventsAtStart;
+        double rate = wall > 0 ? events / wall : 0;
+        double rss = peakRssBytes();
+
+        recordScalar("wallClockTime", wall, "s");
+        recordScalar("events", events);
+        recordScalar("eventsPerSecond", rate);
+        recordScalar("simSecPerSecond", wall > 0 ? simTime().dbl() / wall : 0);
+        recordScalar("peakRss", rss, "B");
+
+        EV << "\n";
+        EV << "========================================\n";
+        EV << "RUN STATISTICS\n";
+        EV << "========================================\n";
+        EV << "Wall-clock time  : " << wall << " s\n";
+        EV << "Events           : " << events << "\n";
+        EV << "Events/sec       : " << rate << "\n";
+        EV << "Peak RSS         : " << rss / (1024 * 1024) << " MiB\n";
+        EV << "========================================\n";
+        EV << "\n";
+    }
+};
+
+Define_Module(RunMonitor);
@@ -0,0 +1,99 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <algorithm>
+
+// Bounded multi-class FIFO in front of a server's workers. Class 0 is the
+// most important. Dequeueing is either strict priority or deficit round
+// robin with per-class weights (one unit of credit per item). When the
+// queue is full an arrival is either dropped (drop-tail) or, with push-out,
+// takes the place of the newest item of the least important class below it.
+template <typename T>
+class ServiceQueue {
+  public:
+    enum Discipline { STRICT, WEIGHTED };
+    enum Admission { DROP_TAIL, PUSH_OUT };
+    enum Result { ADMITTED, DROPPED, ADMITTED_EVICTED };
+
+  private:
+    std::vector<std::deque<T>> queues;
+    std::vector<int> weights;
+    std::vector<int> deficit;
+    Discipline discipline = STRICT;
+    Admission admission = DROP_TAIL;
+    int capacity = 0;
+    int total = 0;
+    int current = 0;  // class the round robin is serving
+
+  public:
+    void init(int numClasses, int cap, Discipline d, Admission a, const std::vector<int>& w) {
+        queues.assign(numClasses, std::deque<T>());
+        weights.assign(numClasses, 1);
+        for (int i = 0; i < numClasses && i < (int)w.size(); i++)
+            weights[i] = std::max(w[i], 1);
+        deficit.assign(numClasses, 0);
+        capacity = cap;
+        discipline = d;
+        admission = a;
+        total = 0;
+        current = numClasses - 1;  // so the first round starts at class 0
+    }
+
+    // On ADMITTED_EVICTED the pushed-out item and its class are returned
+    // in evicted/evictedClass; the caller owns it from then on.
+    Result push(int cls, const T& item, T& evicted, int& evictedClass) {
+        if (total < capacity) {
+            queues[cls].push_back(item);
+            total++;
+            return ADMITTED;
+        }
+        if (admission == PUSH_OUT) {
+            for (int c = (int)queues.size() - 1; c > cls; c--) {
+                if (queues[c].empty()) continue;
+                evicted = queues[c].back();
+                evictedClass = c;
+                queues[c].pop_back();
+                queues[cls].push_back(item);
+                return ADMITTED_EVICTED;
+            }
+        }
+        return DROPPED;
+    }
+
+    bool pop(T& item, int& cls) {
+        if (total == 0) return false;
+        if (discipline == STRICT) {
+            for (cls = 0; queues[cls].empty(); cls++) {}
+        }
+        else {
+            while (queues[current].empty() || deficit[current] == 0) {
+                if (queues[current].empty()) deficit[current] = 0;
+                current = (current + 1) % queues.size();
+                if (!queues[current].empty()) deficit[current] += weights[current];
+            }
+            deficit[current]--;
+            cls = current;
+        }
+        item = queues[cls].front();
+        queues[cls].pop_front();
+        total--;
+        return true;
+    }
+
+    // Empties every class, handing each item to dispose
+    template <typename F>
+    void clear(F dispose) {
+        for (auto& q : queues) {
+            for (T& item : q) dispose(item);
+            q.clear();
+        }
+        std::fill(deficit.begin(), deficit.end(), 0);
+        total = 0;
+        current = (int)queues.size() - 1;
+    }
+
+    int size() const { return total; }
+    const std::deque<T>& items(int cls) const { return queues[cls]; }
+    int size(int cls) const { return (int)queues[cls].size(); }
+    int getCapacity() const { return capacity; }
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Consistent hashing of client shards onto the servers of a cluster
+// (Karger et al., 1997). A client id hashes to one of numShards shards.
+// Every member puts vnodes points on a 64-bit ring, derived from its
+// hostId alone, so all members compute the same ring without talking. A
+// shard is owned by the first live member clockwise of the shard's own
+// point and copied to the next replicas distinct live members after it.
+// A member leaving or joining only changes the placement of the shards
+// next to its points; every other shard keeps its owner and copies.
+class ShardRing {
+  private:
+    std::vector<int> members;                    // hostIds, in configuration order
+    std::vector<bool> alive;
+    std::vector<std::pair<uint64_t, int>> points;  // (position, member), sorted
+    int shards = 0;
+    int copies = 1;                              // owner plus replicas
+    std::vector<int> placed;                     // copies per shard, owner first, -1 = none
+
+    static uint64_t mix(uint64_t x) {
+        // splitmix64 finalizer
+        x += 0x9e3779b97f4a7c15ULL;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+  public:
+    void init(const std::vector<int>& hostIds, int vnodes, int numShards, int replicas) {
+        members = hostIds;
+        alive.assign(members.size(), true);
+        shards = std::max(numShards, 1);
+        copies = std::max(replicas, 0) + 1;
+        points.clear();
+        for (size_t m = 0; m < members.size(); m++)
+            for (int v = 0; v < vnodes; v++)
+                points.push_back({mix((uint64_t)(uint32_t)members[m] << 32 | (uint32_t)v), (int)m});
+        std::sort(points.begin(), points.end());
+        rebuild();
+    }
+
+    int size() const { return members.size(); }
+    int numShards() const { return shards; }
+    int numCopies() const { return copies; }
+    int hostIdOf(int m) const { return members[m]; }
+
+    // Member index of hostId, -1 if it is no member
+    int memberOf(int hostId) const {
+        for (size_t m = 0; m < members.size(); m++)
+            if (members[m] == hostId) return m;
+        return -1;
+    }
+
+    int shardOf(int clientId) const {
+        return (int)(mix((uint64_t)(uint32_t)clientId | 1ULL << 63) % (uint64_t)shards);
+    }
+
+    bool isAlive(int m) const { return alive[m]; }
+
+    // Takes effect with the next rebuild()
+    void setAlive(int m, bool a) { alive[m] = a; }
+
+    // Places every shard on the live members
+    void rebuild() {
+        placed.assign((size_t)shards * copies, -1);
+        if (points.empty()) return;
+        for (int s = 0; s < shards; s++) {
+            uint64_t at = mix((uint64_t)s | 1ULL << 62);
+            size_t i = std::lower_bound(points.begin(), points.end(), std::make_pair(at, -1)) - points.begin();
+            int *row = &placed[(size_t)s * copies];
+            int found = 0;
+            for (size_t n = 0; n < points.size() && found < copies; n++) {
+                int m = points[(i + n) % points.size()].second;
+                if (!alive[m] || std::find(row, row + found, m) != row + found) continue;
+                row[found++] = m;
+            }
+        }
+    }
+
+    // Owner first, then the replicas; -1 where too few members are alive
+    const std::vector<int>& placement() const { return placed; }
+    int ownerOf(int shard) const { return placed[(size_t)shard * copies]; }
+
+    bool holds(int shard, int m) const {
+        const int *row = &placed[(size_t)shard * copies];
+        return std::find(row, row + copies, m) != row + copies;
+    }
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timing wheel (Varghese & Lauck) over integer ticks. Four
+// levels of 256 slots cover 2^32 ticks; an entry sits in the lowest level
+// whose span still separates it from the current tick and is cascaded down
+// as time approaches. Insert is O(1) and advancing costs one step per
+// occupied level-0 slot or 256-tick boundary, however many entries exist,
+// so the owner needs a single self-message to drive any number of timers.
+class TimingWheel {
+  public:
+    struct Entry {
+        int key;
+        int tag;       // owner-defined entry type
+        int64_t tick;
+    };
+
+    enum { BITS = 8, SLOTS = 1 << BITS, LEVELS = 4 };
+
+  private:
+    std::vector<Entry> slots[LEVELS][SLOTS];
+    int64_t now = 0;    // every tick before this one has been delivered
+    size_t count = 0;
+
+    void place(const Entry& e) {
+        int64_t diff = e.tick ^ now;
+        int level = 0;
+        while (level < LEVELS - 1 && (diff >> (BITS * (level + 1))) != 0)
+            level++;
+        slots[level][(e.tick >> (BITS * level)) & (SLOTS - 1)].push_back(e);
+    }
+
+    // now just entered a new slot at each level whose lower bits are zero;
+    // redistribute those slots, highest level first
+    void cascade() {
+        for (int level = LEVELS - 1; level >= 1; level--) {
+            if ((now & (((int64_t)1 << (BITS * level)) - 1)) != 0) continue;
+            std::vector<Entry> moved;
+            moved.swap(slots[level][(now >> (BITS * level)) & (SLOTS - 1)]);
+            for (const Entry& e : moved)
+                place(e);
+        }
+    }
+
+  public:
+    size_t size() const { return count; }
+    int64_t getNow() const { return now; }
+
+    // Returns the tick actually used: past ticks fire at the next advance,
+    // ticks beyond the horizon are clamped and must be re-armed by the owner.
+    int64_t insert(int key, int tag, int64_t tick) {
+        const int64_t maxAhead = (int64_t)(SLOTS - 1) << (BITS * (LEVELS - 1));
+        if (tick < now) tick = now;
+        if (tick - now >= maxAhead) tick = now + maxAhead - 1;
+        place({key, tag, tick});
+        count++;
+        return tick;
+    }
+
+    // Delivers every entry due at or before target into due.
+    void advance(int64_t target, std::vector<Entry>& due) {
+        while (now <= target) {
+            std::vector<Entry>& slot = slots[0][now & (SLOTS - 1)];
+            if (!slot.empty()) {
+                due.insert(due.end(), slot.begin(), slot.end());
+                count -= slot.size();
+                slot.clear();
+            }
+
+            // Skip empty level-0 slots up to the next boundary
+            int idx = (int)(now & (SLOTS - 1)) + 1;
+            while (idx < SLOTS && slots[0][idx].empty()) idx++;
+            int64_t next = (now & ~(int64_t)(SLOTS - 1)) + idx;
+            if (next > target + 1) next = target + 1;
+            now = next;
+            if ((now & (SLOTS - 1)) == 0)
+                cascade();
+        }
+    }
+
+    // Earliest tick worth calling advance() for, or -1 when empty. This is
+    // either a due slot or the next boundary where entries cascade down.
+    int64_t nextDeadline() const {
+        if (count == 0) return -1;
+        for (int idx = (int)(now & (SLOTS - 1)); idx < SLOTS; idx++)
+            if (!slots[0][idx].empty())
+                return (now & ~(int64_t)(SLOTS - 1)) + idx;
+        return (now | (SLOTS - 1)) + 1;
+    }
+};
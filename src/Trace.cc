@@ -0,0 +1,72 @@
+#include "Trace.h"
+#include <cstdio>
+#include <algorithm>
+
+using namespace omnetpp;
+
+Register_PerRunConfigOption(CFGID_DHCP_TRACE_CAPACITY, "dhcp-trace-capacity", CFG_INT, "0",
+        "Number of records kept in the binary DHCP trace ring; 0 disables tracing.");
+Register_PerRunConfigOption(CFGID_DHCP_TRACE_FILE, "dhcp-trace-file", CFG_FILENAME,
+        "${resultdir}/${configname}-#${repetition}.trace",
+        "File the DHCP trace ring is written to at the end of the run.");
+
+TraceRing& TraceRing::instance() {
+    static TraceRing ring;
+    return ring;
+}
+
+void TraceRing::attach() {
+    if (!listening) {
+        getEnvir()->addLifecycleListener(this);
+        listening = true;
+    }
+    if (attached++ > 0) return;
+    cConfiguration *cfg = getEnvir()->getConfig();
+    long capacity = cfg ? cfg->getAsInt(CFGID_DHCP_TRACE_CAPACITY) : 0;
+    ring.assign(capacity > 0 ? capacity : 0, Record());
+    head = 0;
+    total = 0;
+    fileName = cfg && capacity > 0 ? cfg->getAsFilename(CFGID_DHCP_TRACE_FILE) : "";
+
+    // Under parallel simulation every partition is a process of its own
+    // with its own ring; suffix the file so they do not overwrite each other
+    if (!fileName.empty() && getEnvir()->getParsimNumPartitions() > 1)
+        fileName += "." + std::to_string(getEnvir()->getParsimProcId());
+}
+
+void TraceRing::detach() {
+    if (attached == 0 || --attached > 0) return;
+    if (isEnabled() && !fileName.empty() && !dump(fileName.c_str()))
+        EV << "WARN: could not write DHCP trace to " << fileName << "\n";
+    ring.clear();
+    ring.shrink_to_fit();
+}
+
+void TraceRing::lifecycleEvent(SimulationLifecycleEventType type, cObject *details) {
+    if (type != LF_PRE_NETWORK_DELETE || attached == 0) return;
+    // Some module never detached: the ring up to the error is the useful part
+    attached = 1;
+    detach();
+}
+
+bool TraceRing::dump(const char *path) const {
+    FILE *f = fopen(path, "wb");
+    if (!f) return false;
+
+    // Header: magic, record size, records in file, records ever recorded
+    size_t count = total < ring.size() ? (size_t)total : ring.size();
+    uint32_t header[2] = { 0x43524454 /* "TDRC" */, (uint32_t)sizeof(Record) };
+    uint64_t counts[2] = { (uint64_t)count, total };
+    bool ok = fwrite(header, sizeof(header), 1, f) == 1
+           && fwrite(counts, sizeof(counts), 1, f) == 1;
+
+    // Oldest first: once the ring has wrapped, that is the slot at head
+    size_t start = total > ring.size() ? head : 0;
+    size_t firstRun = std::min(count, ring.size() - start);
+    if (ok && firstRun > 0)
+        ok = fwrite(&ring[start], sizeof(Record), firstRun, f) == firstRun;
+    if (ok && count > firstRun)
+        ok = fwrite(&ring[0], sizeof(Record), count - firstRun, f) == count - firstRun;
+
+    return fclose(f) == 0 && ok;
+}
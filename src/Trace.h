@@ -0,0 +1,123 @@
+#pragma once
+#include <omnetpp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "DhcpMessages_m.h"
+
+// ============================================================================
+// LOGGING
+// Log statements above DHCP_LOG_LEVEL are compiled out entirely. Those that
+// remain are skipped at run time when the environment has logging turned
+// off (Cmdenv express mode), before any of the << operands are formatted.
+// Build with e.g. CFLAGS=-DDHCP_LOG_LEVEL=0 to strip all protocol logging.
+// ============================================================================
+#define DHCP_LOG_OFF    0
+#define DHCP_LOG_INFO   1   // one line per protocol event
+#define DHCP_LOG_DETAIL 2   // banners and per-lease dumps
+
+#ifndef DHCP_LOG_LEVEL
+#define DHCP_LOG_LEVEL DHCP_LOG_INFO
+#endif
+
+#define DHCP_LOG(level) \
+    if ((level) > DHCP_LOG_LEVEL || !omnetpp::getEnvir()->isLoggingEnabled()) ; else EV
+
+#define DLOG_INFO   DHCP_LOG(DHCP_LOG_INFO)
+#define DLOG_DETAIL DHCP_LOG(DHCP_LOG_DETAIL)
+
+// ============================================================================
+// TRACE RING
+// Fixed-size binary record of protocol events, for post-mortem analysis of
+// runs too large to log. Enabled per run with dhcp-trace-capacity; the
+// oldest records are overwritten once the ring is full. The ring is written
+// to dhcp-trace-file when the last traced module finishes, or on demand
+// with dump(). Build with -DDHCP_TRACE=0 to compile the hooks out.
+// ============================================================================
+#ifndef DHCP_TRACE
+#define DHCP_TRACE 1
+#endif
+
+// Kinds for traced events that are not messages; message kinds are 6xx
+#define TRACE_TAKEOVER      701
+#define TRACE_FAILURE       702
+#define TRACE_LEASE_EXPIRED 703
+#define TRACE_LEASE_CONFLICT 704
+
+class TraceRing : public omnetpp::cISimulationLifecycleListener {
+  public:
+    struct Record {
+        int64_t  time;       // raw simtime
+        int32_t  moduleId;
+        int16_t  kind;       // message kind
+        int16_t  flags;      // reserved
+        uint64_t addrHi;
+        uint64_t addrLo;
+    };
+    static_assert(sizeof(Record) == 32, "trace records are written as-is");
+
+    static TraceRing& instance();
+
+    // Every module that traces attaches in initialize() and detaches in
+    // finish(); the first attach of a run reads the configuration and the
+    // last detach writes the file. A run that ends in an error never gets
+    // to finish(); its ring is written and reset when the network is
+    // deleted.
+    void attach();
+    void detach();
+
+    bool isEnabled() const { return !ring.empty(); }
+
+    void record(int moduleId, short kind, const Ip6Address& addr) {
+        if (ring.empty()) return;
+        Record& r = ring[head];
+        r.time = omnetpp::simTime().raw();
+        r.moduleId = moduleId;
+        r.kind = kind;
+        r.flags = 0;
+        r.addrHi = addr.hi;
+        r.addrLo = addr.lo;
+        if (++head == ring.size()) head = 0;
+        total++;
+    }
+
+    // Writes the ring oldest-first behind a small header; returns false if
+    // the file could not be written
+    bool dump(const char *path) const;
+
+    uint64_t getTotal() const { return total; }
+
+  protected:
+    virtual void lifecycleEvent(omnetpp::SimulationLifecycleEventType type, omnetpp::cObject *details) override;
+    virtual void listenerRemoved() override { listening = false; }
+
+  private:
+    std::vector<Record> ring;
+    size_t head = 0;
+    uint64_t total = 0;
+    int attached = 0;
+    bool listening = false;
+    std::string fileName;
+};
+
+// Address carried by a client message, unspecified if it has none
+inline Ip6Address traceAddressOf(const omnetpp::cMessage *msg) {
+    if (auto *m = dynamic_cast<const DhcpAdvertise *>(msg)) return m->getAddress();
+    if (auto *m = dynamic_cast<const DhcpRequest *>(msg)) return m->getAddress();
+    if (auto *m = dynamic_cast<const DhcpReply *>(msg)) return m->getAddress();
+    if (auto *m = dynamic_cast<const DhcpRenew *>(msg)) return m->getAddress();
+    if (auto *m = dynamic_cast<const DhcpRelease *>(msg)) return m->getAddress();
+    if (auto *m = dynamic_cast<const DhcpDecline *>(msg)) return m->getAddress();
+    return Ip6Address();
+}
+
+#if DHCP_TRACE
+#define DHCP_TRACE_MSG(module, msg) \
+    do { TraceRing& _tr = TraceRing::instance(); \
+         if (_tr.isEnabled()) _tr.record((module)->getId(), (msg)->getKind(), traceAddressOf(msg)); } while (0)
+#define DHCP_TRACE_EVENT(module, kind, addr) \
+    TraceRing::instance().record((module)->getId(), (kind), (addr))
+#else
+#define DHCP_TRACE_MSG(module, msg) do {} while (0)
+#define DHCP_TRACE_EVENT(module, kind, addr) do {} while (0)
+#endif
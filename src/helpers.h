@@ -1,5 +1,8 @@
 #pragma once
 #include <omnetpp.h>
+#include <cstring>
+#include <cstdint>
+#include "DhcpMessages_m.h"
 
 #define DHCPV6_SOLICIT    601
 #define DHCPV6_ADVERTISE  602
@@ -7,13 +10,61 @@
 #define DHCPV6_REPLY      604
 #define DHCP_SYNC         605
 #define DHCP_HEARTBEAT    606
+#define DHCPV6_RENEW      607
+#define DHCPV6_REBIND     608
+#define DHCPV6_RELEASE    609
+#define DHCP_CATCHUP_REQUEST  610
+#define DHCP_CATCHUP_CHUNK    611
+#define DHCP_FAILBACK_REQUEST 612
+#define DHCP_FAILBACK_ACK     613
+#define DHCPV6_RELAY_FORW 614
+#define DHCPV6_RELAY_REPL 615
+#define DHCPV6_DECLINE    616
+#define DHCP_SHARD_TRANSFER   617
 
-inline omnetpp::cMessage* mk(const char* name, int kind, long src, long dst) {
-    auto *m = new omnetpp::cMessage(name, kind);
-    m->addPar("src").setLongValue(src);
-    m->addPar("dst").setLongValue(dst);
+template <typename T>
+inline T* mk(const char* name, int kind, int src, int dst) {
+    auto *m = new T(name, kind);
+    m->setSrcId(src);
+    m->setDstId(dst);
     return m;
 }
 
-inline long SRC(omnetpp::cMessage *m) { return m->par("src").longValue(); }
-inline long DST(omnetpp::cMessage *m) { return m->par("dst").longValue(); }
+inline int SRC(const DhcpMessage *m) { return m->getSrcId(); }
+inline int DST(const DhcpMessage *m) { return m->getDstId(); }
+
+inline int deviceClassFromName(const char* type) {
+    if (!strcmp(type, "mobile"))  return DEVCLASS_MOBILE;
+    if (!strcmp(type, "printer")) return DEVCLASS_PRINTER;
+    if (!strcmp(type, "server"))  return DEVCLASS_SERVER;
+    if (!strcmp(type, "router"))  return DEVCLASS_ROUTER;
+    return DEVCLASS_PC;
+}
+
+inline const char* deviceClassName(int devClass) {
+    switch (devClass) {
+        case DEVCLASS_MOBILE:  return "mobile";
+        case DEVCLASS_PRINTER: return "printer";
+        case DEVCLASS_SERVER:  return "server";
+        case DEVCLASS_ROUTER:  return "router";
+        default:               return "pc";
+    }
+}
+
+// Servers and routers are always VIP, everything else from the cutoff up
+inline bool isVipClass(int devClass, int prio, int vipPriorityCutoff) {
+    if (devClass == DEVCLASS_SERVER || devClass == DEVCLASS_ROUTER) return true;
+    return prio >= vipPriorityCutoff;
+}
+
+// Load-balancing bucket of a client, 0..255 (RFC 3074 style). A fixed
+// integer mix of the client id, so both servers agree without talking.
+inline int loadBalanceBucket(int clientId) {
+    uint32_t h = (uint32_t)clientId;
+    h ^= h >> 16;
+    h *= 0x7feb352dU;
+    h ^= h >> 15;
+    h *= 0x846ca68bU;
+    h ^= h >> 16;
+    return (int)(h & 0xff);
+}
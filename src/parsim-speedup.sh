@@ -0,0 +1,48 @@
+#!/bin/sh
+# Parallel speedup on the Scale100k topology: runs Parsim1 in one process,
+# then each ParsimN with one process per partition over named pipes, and
+# prints the wallClockTime the monitor recorded and the speedup over
+# Parsim1. Partition counts default to 2 4 8.
+#   ./parsim-speedup.sh [N...]
+cd `dirname $0`
+RESULTS=results/parsim
+mkdir -p $RESULTS comm/read
+rm -f $RESULTS/Parsim*.sca
+[ $# -eq 0 ] && set -- 2 4 8
+
+run() {
+    if [ $1 -eq 1 ]; then
+        ./prioritydhcp -u Cmdenv -c Parsim1 --result-dir=$RESULTS > $RESULTS/Parsim1.log 2>&1
+        return
+    fi
+    p=0
+    while [ $p -lt $1 ]; do
+        ./prioritydhcp -u Cmdenv -c Parsim$1 --result-dir=$RESULTS -p$p,$1 > $RESULTS/Parsim$1-p$p.log 2>&1 &
+        p=$((p + 1))
+    done
+    wait
+}
+
+# Only partition 0 holds the monitor, so one result file has the scalar
+wallclock() {
+    opp_scavetool export -F CSV-R -o /dev/stdout -f 'module=~*.monitor AND name=~wallClockTime' \
+        $RESULTS/Parsim$1-*.sca 2>/dev/null | awk -F, '$2 == "scalar" { print $7; exit }'
+}
+
+run 1
+base=`wallclock 1`
+if [ -z "$base" ]; then
+    echo "Parsim1 recorded no wallClockTime, see $RESULTS/Parsim1.log" >&2
+    exit 1
+fi
+printf "%-12s %12s  %s\n" partitions wallClock speedup
+printf "%-12s %12.2fs  %s\n" 1 $base 1.00
+for n in "$@"; do
+    run $n
+    t=`wallclock $n`
+    if [ -z "$t" ]; then
+        echo "Parsim$n recorded no wallClockTime, see $RESULTS/Parsim$n-p*.log" >&2
+        continue
+    fi
+    printf "%-12s %12.2fs  %.2f\n" $n $t `echo "$base $t" | awk '{ print $1 / $2 }'`
+done
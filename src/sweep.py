@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Runs every run of a config on all local cores and merges the results.
+
+    ./sweep.py run Sweep [-j N] [-r FILTER]
+    ./sweep.py collect Sweep [-o FILE] [-f FILTER]
+
+'run' asks the simulation for the run numbers of the config and feeds them
+to a pool of worker processes, one Cmdenv process per run, so the matrix
+finishes in roughly (runs / cores) run-times. Every run logs to
+results/<config>-<run>.log; failed runs are listed at the end.
+
+'collect' exports the config's .sca and .vec files through opp_scavetool
+and writes one row per configuration point and result: the iteration
+variables, module, name, the number of repetitions, their mean, standard
+deviation and a 95% confidence interval. Scalars contribute their value,
+statistics and histograms their mean, vectors the mean of their values.
+Only the standard library is needed.
+"""
+
+import argparse
+import csv
+import math
+import os
+import subprocess
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor, as_completed
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIMULATION = os.path.join(HERE, "prioritydhcp")
+RESULTS = os.path.join(HERE, "results")
+
+# Two-sided 95% Student t quantiles by degrees of freedom
+T95 = [0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+       2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+       2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+       2.042]
+
+
+def t95(df):
+    if df < len(T95):
+        return T95[df]
+    return 2.000 if df < 60 else 1.980 if df < 120 else 1.960
+
+
+def simulation_args(config):
+    return [SIMULATION, "-u", "Cmdenv", "-c", config]
+
+
+def run_numbers(config, run_filter):
+    args = simulation_args(config) + ["-s", "-q", "runnumbers"]
+    if run_filter:
+        args += ["-r", run_filter]
+    out = subprocess.run(args, cwd=HERE, stdout=subprocess.PIPE,
+                         universal_newlines=True, check=True).stdout
+    return [int(tok) for tok in out.split() if tok.isdigit()]
+
+
+def run_one(config, run):
+    log = os.path.join(RESULTS, "%s-%d.log" % (config, run))
+    start = time.time()
+    with open(log, "w") as f:
+        code = subprocess.call(simulation_args(config) + ["-r", str(run)],
+                               cwd=HERE, stdout=f, stderr=subprocess.STDOUT)
+    return run, code, time.time() - start
+
+
+def cmd_run(opts):
+    runs = run_numbers(opts.config, opts.filter)
+    if not runs:
+        sys.exit("%s has no runs" % opts.config)
+    os.makedirs(RESULTS, exist_ok=True)
+    jobs = min(opts.jobs, len(runs))
+    print("%s: %d runs on %d workers" % (opts.config, len(runs), jobs))
+
+    start = time.time()
+    failed = []
+    with ThreadPoolExecutor(max_workers=jobs) as pool:
+        futures = [pool.submit(run_one, opts.config, run) for run in runs]
+        for done, future in enumerate(as_completed(futures), 1):
+            run, code, seconds = future.result()
+            if code != 0:
+                failed.append(run)
+            print("[%d/%d] run %d %s in %.1fs" % (done, len(runs), run,
+                  "FAILED" if code else "done", seconds), flush=True)
+
+    print("%s: %d runs in %.1fs" % (opts.config, len(runs), time.time() - start))
+    if failed:
+        print("failed runs, see results/%s-<run>.log: %s"
+              % (opts.config, " ".join(map(str, sorted(failed)))))
+        sys.exit(1)
+
+
+def export_rows(files, result_filter):
+    args = ["opp_scavetool", "export", "-F", "CSV-R", "-o", "/dev/stdout"]
+    if result_filter:
+        args += ["-f", result_filter]
+    proc = subprocess.Popen(args + files, stdout=subprocess.PIPE,
+                            universal_newlines=True)
+    csv.field_size_limit(sys.maxsize)  # vector rows carry all their values
+    for row in csv.DictReader(proc.stdout):
+        yield row
+    if proc.wait() != 0:
+        sys.exit("opp_scavetool failed")
+
+
+def value_of(row):
+    kind = row["type"]
+    if kind == "scalar":
+        text = row["value"]
+    elif kind in ("statistic", "histogram"):
+        text = row["mean"]
+    elif kind == "vector":
+        values = [float(v) for v in row["vecvalue"].split()]
+        return sum(values) / len(values) if values else None
+    else:
+        return None
+    try:
+        value = float(text)
+    except ValueError:
+        return None
+    return None if math.isnan(value) else value
+
+
+def cmd_collect(opts):
+    prefix = opts.config + "-"
+    entries = sorted(os.listdir(RESULTS)) if os.path.isdir(RESULTS) else []
+    files = [os.path.join(RESULTS, f) for f in entries
+             if f.startswith(prefix) and f.endswith((".sca", ".vec"))]
+    if not files:
+        sys.exit("no result files for %s in %s" % (opts.config, RESULTS))
+
+    # Iteration variables per run; repetition is what gets averaged over
+    itervars = {}
+    samples = {}
+    for row in export_rows(files, opts.filter):
+        run = row["run"]
+        if row["type"] == "itervar":
+            if row["attrname"] != "repetition":
+                itervars.setdefault(run, {})[row["attrname"]] = row["attrvalue"]
+            continue
+        value = value_of(row)
+        if value is not None:
+            samples.setdefault((run, row["module"], row["name"]), []).append(value)
+
+    names = sorted({name for point in itervars.values() for name in point})
+    table = {}
+    for (run, module, name), values in samples.items():
+        point = tuple(itervars.get(run, {}).get(n, "") for n in names)
+        table.setdefault((point, module, name), []).extend(values)
+
+    out = opts.output or os.path.join(RESULTS, opts.config + "-summary.csv")
+    with open(out, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(names + ["module", "name", "n", "mean", "stddev", "ci95Low", "ci95High"])
+        for (point, module, name), values in sorted(table.items()):
+            n = len(values)
+            mean = sum(values) / n
+            sd = math.sqrt(sum((v - mean) ** 2 for v in values) / (n - 1)) if n > 1 else 0.0
+            half = t95(n - 1) * sd / math.sqrt(n) if n > 1 else 0.0
+            writer.writerow(list(point) + [module, name, n, "%.6g" % mean, "%.6g" % sd,
+                                           "%.6g" % (mean - half), "%.6g" % (mean + half)])
+    print("%s: %d points, %d rows -> %s" % (opts.config, len({k[0] for k in table}), len(table), out))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    sub = parser.add_subparsers(dest="command")
+    sub.required = True
+
+    p = sub.add_parser("run", help="execute all runs of a config in parallel")
+    p.add_argument("config")
+    p.add_argument("-j", "--jobs", type=int, default=os.cpu_count() or 1)
+    p.add_argument("-r", "--filter", help="run filter as for -r, e.g. '$repetition<5'")
+    p.set_defaults(func=cmd_run)
+
+    p = sub.add_parser("collect", help="merge a config's results into one table")
+    p.add_argument("config")
+    p.add_argument("-o", "--output", help="CSV file, default results/<config>-summary.csv")
+    p.add_argument("-f", "--filter", help="opp_scavetool result filter, e.g. 'module=~*.monitor'")
+    p.set_defaults(func=cmd_collect)
+
+    opts = parser.parse_args()
+    opts.func(opts)
+
+
+if __name__ == "__main__":
+    main()
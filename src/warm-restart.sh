@@ -0,0 +1,35 @@
+#!/bin/sh
+# Cold vs. warm restart of the primary at 1M leases (WarmRestart config):
+# run 0 comes back empty and pulls the backup's table, run 1 loads its own
+# lease store, which a first invocation of run 1 leaves behind. Prints the
+# start-up cost of dhcp_main in wall clock, storeLoadTime +
+# catchupApplyTime, and in simulated time, catchupDuration.
+#   ./warm-restart.sh
+cd `dirname $0`
+RESULTS=results/warmrestart
+rm -rf results/leases-* $RESULTS
+mkdir -p $RESULTS/cold $RESULTS/warm
+
+run() {
+    ./prioritydhcp -u Cmdenv -c WarmRestart -r $1 --result-dir=$RESULTS/$2 > $RESULTS/$2.log 2>&1
+}
+
+# Scalar $2 of dhcp_main in $RESULTS/$1; a missing one counts as 0
+scalar() {
+    opp_scavetool export -F CSV-R -o /dev/stdout -f "module=~*.dhcp_main AND name=~\"$2\"" \
+        $RESULTS/$1/*.sca 2>/dev/null | awk -F, '$2 == "scalar" { v = $7; exit } END { print v == "" ? 0 : v }'
+}
+
+run 0 cold
+run 1 warm   # leaves the store behind
+rm -f $RESULTS/warm/*
+run 1 warm
+printf "%-6s %14s %14s %14s\n" start storeLoad catchupApply catchupSim
+for s in cold warm; do
+    if ! ls $RESULTS/$s/*.sca > /dev/null 2>&1; then
+        echo "$s run recorded no results, see $RESULTS/$s.log" >&2
+        continue
+    fi
+    printf "%-6s %13.3fs %13.3fs %13.3fs\n" $s \
+        `scalar $s storeLoadTime` `scalar $s catchupApplyTime` `scalar $s catchupDuration:last`
+done